@@ -1,166 +1,222 @@
 #include "stdafx.h"
 
+#define GANG_MAX_PORTS 64
 
-#define PM_SIZE 1536 /* Max: 144KB/3/32=1536 PM rows for 30F. */
-#define EE_SIZE 128 /* 4KB/2/16=128 EE rows */
-#define CM_SIZE 8
-
-
-
+typedef struct
+{
+	char             * pFileName;
+	char             * pCacheDir;
+	mem_cMemImage    * pImage;
+	tel_cSession     * pSession; /* or NULL */
+	unsigned long long SourceHash;
+	char               CachePath[MAX_PATH];
+	bool               bThread;
+#ifdef _WIN32
+	HANDLE             Thread;
+#else
+	pthread_t          Thread;
+#endif
+} sLoader;
+
+typedef struct
+{
+	char             * pFileName;
+	char             * pCacheDir;
+	char             * pBaudRate;
+	bool               bFixedBaud;
+	bool               bFullWrite;
+	bool               bStats;
+	int                Window;
+	tel_cLog         * pLog;
+
+	CRITICAL_SECTION   Lock;    /* guards the rest */
+	mem_cMemImage    * pImage;  /* parsed once, then only read */
+	const sDevice    * pDevice; /* the image is laid out for */
+	bool               bLoaded;
+	sLoader            Loader;
+} sGang;
+
+typedef struct
+{
+	char             * pName;
+	sGang            * pGang;
+	bool               bDone;
+	int                BytesOut;
+	double             Us;
+#ifdef _WIN32
+	HANDLE             Thread;
+#else
+	pthread_t          Thread;
+#endif
+} sGangPort;
 
-HANDLE OpenConnection (HANDLE *pComDev,  char *pPortName, char *pBaudRate);
-BOOL   WriteCommBlock (HANDLE *pComdDev, char *pBuffer ,  int BytesToWrite);
-int    ReadCommBlock  (HANDLE *pComdDev, char *pBuffer,   int MaxLength);
-BOOL   CloseConnection(HANDLE *pComdDev);
 
-void    ReceiveData(HANDLE *pComDev, char * pBuffer, int BytesToReceive);
 void    PrintUsage(void);
-eFamily ReadID(HANDLE *pComDev);
-void    ReadPM(HANDLE *pComDev, char * pReadPMAddress, eFamily Family);
-void    ReadEE(HANDLE *pComDev, char * pReadEEAddress, eFamily Family);
-void    SendHexFile(HANDLE *pComDev, FILE * pFile, eFamily Family);
-
+bool    Connect(lnk_cLink *pLink, int BaudRate, bool bFixedBaud, int * pCaps, const sDevice ** ppDevice, int * pWindow, tel_cSession * pSession);
+bool    ReadID(lnk_cLink *pLink, int Caps, const sDevice ** ppDevice);
+int     ReadCaps(lnk_cLink *pLink);
+int     NegotiateBaud(lnk_cLink *pLink, int BaudRate);
+bool    ReadPM(lnk_cLink *pLink, char * pReadPMAddress, const sDevice * pDevice, int Caps);
+bool    ReadEE(lnk_cLink *pLink, char * pReadEEAddress, const sDevice * pDevice, int Caps);
+bool    DumpPM(lnk_cLink *pLink, char * pDumpArg, const sDevice * pDevice, int Caps, int Window, tel_cSession * pSession);
+bool    SendHexFile(lnk_cLink *pLink, char * pFileName, char * pCacheDir, const sDevice * pDevice, int Caps, int Window, tel_cSession * pSession);
+mem_cMemImage * StartLoad(sLoader * pLoader, char * pFileName, char * pCacheDir, const sDevice * pDevice, tel_cSession * pSession);
+void    JoinLoad(sLoader * pLoader);
+bool    LoadHexFile(sLoader * pLoader);
+bool    ProgramImage(lnk_cLink *pLink, mem_cMemImage * pImage, int Caps, int Window, tel_cSession * pSession);
+bool    PreserveResetVector(lnk_cLink *pLink, int Caps, mem_cMemImage * pMemory);
+void    PrintStats(lnk_cLink *pLink, int Caps);
+void    ResetTarget(lnk_cLink *pLink, int Caps, tel_cSession * pSession);
+bool    VerifyHexFile(lnk_cLink *pLink, char * pFileName, char * pCacheDir, const sDevice * pDevice, int Caps, tel_cSession * pSession);
+bool    ProgramGang(sGang * pGang, char * pPortNames);
+bool    Benchmark(char * pSuiteName, char * pBaudRate, bool bFixedBaud, int Window);
+
+/* Each part as the bootloader sees it: program memory and the sizes it is
+   erased and written in, data EEPROM, configuration words, and the program
+   memory the bootloader itself takes. Images are laid out to these, so a
+   part only costs the rows it has. PIC24F parts keep their configuration
+   words at the top of program memory and have none at CM_START. */
 sDevice Device[] = 
 {
-	{"dsPIC30F2010",      0x040, 1, dsPIC30F},
-	{"dsPIC30F2011",      0x0C0, 1, dsPIC30F},
-	{"dsPIC30F2011",      0x240, 1, dsPIC30F},
-	{"dsPIC30F2012",      0x0C2, 1, dsPIC30F},
-	{"dsPIC30F2012",      0x241, 1, dsPIC30F},
-	{"dsPIC30F3010",      0x1C0, 1, dsPIC30F},
-	{"dsPIC30F3011",      0x1C1, 1, dsPIC30F},
-	{"dsPIC30F3012",      0x0C1, 1, dsPIC30F},
-	{"dsPIC30F3013",      0x0C3, 1, dsPIC30F},
-	{"dsPIC30F3014",      0x160, 1, dsPIC30F},
-	{"dsPIC30F4011",      0x101, 1, dsPIC30F},
-	{"dsPIC30F4012",      0x100, 1, dsPIC30F},
-	{"dsPIC30F4013",      0x141, 1, dsPIC30F},
-	{"dsPIC30F5011",      0x080, 1, dsPIC30F},
-	{"dsPIC30F5013",      0x081, 1, dsPIC30F},
-	{"dsPIC30F5015",      0x200, 1, dsPIC30F},
-	{"dsPIC30F5016",      0x201, 1, dsPIC30F},
-	{"dsPIC30F6010",      0x188, 1, dsPIC30F},
-	{"dsPIC30F6010A",     0x281, 1, dsPIC30F},
-	{"dsPIC30F6011",      0x192, 1, dsPIC30F},
-	{"dsPIC30F6011A",     0x2C0, 1, dsPIC30F},
-	{"dsPIC30F6012",      0x193, 1, dsPIC30F},
-	{"dsPIC30F6012A",     0x2C2, 1, dsPIC30F},
-	{"dsPIC30F6013",      0x197, 1, dsPIC30F},
-	{"dsPIC30F6013A",     0x2C1, 1, dsPIC30F},
-	{"dsPIC30F6014",      0x198, 1, dsPIC30F},
-	{"dsPIC30F6014A",     0x2C3, 1, dsPIC30F},
-	{"dsPIC30F6015",      0x280, 1, dsPIC30F},
-
-	{"dsPIC33FJ64GP206",  0xC1, 3, dsPIC33F},
-	{"dsPIC33FJ64GP306",  0xCD, 3, dsPIC33F},
-	{"dsPIC33FJ64GP310",  0xCF, 3, dsPIC33F},
-	{"dsPIC33FJ64GP706",  0xD5, 3, dsPIC33F},
-	{"dsPIC33FJ64GP708",  0xD6, 3, dsPIC33F},
-	{"dsPIC33FJ64GP710",  0xD7, 3, dsPIC33F},
-	{"dsPIC33FJ128GP206", 0xD9, 3, dsPIC33F},
-	{"dsPIC33FJ128GP306", 0xE5, 3, dsPIC33F},
-	{"dsPIC33FJ128GP310", 0xE7, 3, dsPIC33F},
-	{"dsPIC33FJ128GP706", 0xED, 3, dsPIC33F},
-	{"dsPIC33FJ128GP708", 0xEE, 3, dsPIC33F},
-	{"dsPIC33FJ128GP710", 0xEF, 3, dsPIC33F},
-	{"dsPIC33FJ256GP506", 0xF5, 3, dsPIC33F},
-	{"dsPIC33FJ256GP510", 0xF7, 3, dsPIC33F},
-	{"dsPIC33FJ256GP710", 0xFF, 3, dsPIC33F},
-	{"dsPIC33FJ64MC506",  0x89, 3, dsPIC33F},
-	{"dsPIC33FJ64MC508",  0x8A, 3, dsPIC33F},
-	{"dsPIC33FJ64MC510",  0x8B, 3, dsPIC33F},
-	{"dsPIC33FJ64MC706",  0x91, 3, dsPIC33F},
-	{"dsPIC33FJ64MC710",  0x97, 3, dsPIC33F},
-	{"dsPIC33FJ128MC506", 0xA1, 3, dsPIC33F},
-	{"dsPIC33FJ128MC510", 0xA3, 3, dsPIC33F},
-	{"dsPIC33FJ128MC706", 0xA9, 3, dsPIC33F},
-	{"dsPIC33FJ128MC708", 0xAE, 3, dsPIC33F},
-	{"dsPIC33FJ128MC710", 0xAF, 3, dsPIC33F},
-	{"dsPIC33FJ256MC510", 0xB7, 3, dsPIC33F},
-	{"dsPIC33FJ256MC710", 0xBF, 3, dsPIC33F},
-
-	{"dsPIC33FJ12GP201", 0x802, 3, dsPIC33F},
-	{"dsPIC33FJ12GP202", 0x803, 3, dsPIC33F},
-	{"dsPIC33FJ12MC201", 0x800, 3, dsPIC33F},
-	{"dsPIC33FJ12MC202", 0x801, 3, dsPIC33F},
-
-	{"dsPIC33FJ32GP204", 0xF0F, 3, dsPIC33F},
-	{"dsPIC33FJ32GP202", 0xF0D, 3, dsPIC33F},
-	{"dsPIC33FJ16GP304", 0xF07, 3, dsPIC33F},
-	{"dsPIC33FJ32MC204", 0xF0B, 3, dsPIC33F},
-	{"dsPIC33FJ32MC202", 0xF09, 3, dsPIC33F},
-	{"dsPIC33FJ16MC304", 0xF03, 3, dsPIC33F},
-
-	{"dsPIC33FJ128GP804", 0x62F, 3, dsPIC33F},
-	{"dsPIC33FJ128GP802", 0x62D, 3, dsPIC33F},
-	{"dsPIC33FJ128GP204", 0x627, 3, dsPIC33F},
-	{"dsPIC33FJ128GP202", 0x625, 3, dsPIC33F},
-	{"dsPIC33FJ64GP804",  0x61F, 3, dsPIC33F},
-	{"dsPIC33FJ64GP802",  0x61D, 3, dsPIC33F},
-	{"dsPIC33FJ64GP204",  0x617, 3, dsPIC33F},
-	{"dsPIC33FJ64GP202",  0x615, 3, dsPIC33F},
-	{"dsPIC33FJ32GP304",  0x607, 3, dsPIC33F},
-	{"dsPIC33FJ32GP302",  0x605, 3, dsPIC33F},
-	{"dsPIC33FJ128MC804", 0x62B, 3, dsPIC33F},
-	{"dsPIC33FJ128MC802", 0x629, 3, dsPIC33F},
-	{"dsPIC33FJ128MC204", 0x623, 3, dsPIC33F},
-	{"dsPIC33FJ128MC202", 0x621, 3, dsPIC33F},
-	{"dsPIC33FJ64MC804",  0x61B, 3, dsPIC33F},
-	{"dsPIC33FJ64MC802",  0x619, 3, dsPIC33F},
-	{"dsPIC33FJ64MC204",  0x613, 3, dsPIC33F},
-	{"dsPIC33FJ64MC202",  0x611, 3, dsPIC33F},
-	{"dsPIC33FJ32MC304",  0x603, 3, dsPIC33F},
-	{"dsPIC33FJ32MC302",  0x601, 3, dsPIC33F},
-
-	{"dsPIC33FJ06GS101",  0xC00, 3, dsPIC33F},
-	{"dsPIC33FJ06GS102",  0xC01, 3, dsPIC33F},
-	{"dsPIC33FJ06GS202",  0xC02, 3, dsPIC33F},
-	{"dsPIC33FJ16GS402",  0xC04, 3, dsPIC33F},
-	{"dsPIC33FJ16GS404",  0xC06, 3, dsPIC33F},
-	{"dsPIC33FJ16GS502",  0xC03, 3, dsPIC33F},
-	{"dsPIC33FJ16GS504",  0xC05, 3, dsPIC33F},
-
-	{"PIC24HJ64GP206",    0x41, 3, PIC24H},
-	{"PIC24HJ64GP210",    0x47, 3, PIC24H},
-	{"PIC24HJ64GP506",    0x49, 3, PIC24H},
-	{"PIC24HJ64GP510",    0x4B, 3, PIC24H},
-	{"PIC24HJ128GP206",   0x5D, 3, PIC24H},
-	{"PIC24HJ128GP210",   0x5F, 3, PIC24H},
-	{"PIC24HJ128GP306",   0x65, 3, PIC24H},
-	{"PIC24HJ128GP310",   0x67, 3, PIC24H},
-	{"PIC24HJ128GP506",   0x61, 3, PIC24H},
-	{"PIC24HJ128GP510",   0x63, 3, PIC24H},
-	{"PIC24HJ256GP206",   0x71, 3, PIC24H},
-	{"PIC24HJ256GP210",   0x73, 3, PIC24H},
-	{"PIC24HJ256GP610",   0x7B, 3, PIC24H},
-
-	{"PIC24HJ12GP201", 0x80A, 3, PIC24H},
-	{"PIC24HJ12GP202", 0x80B, 3, PIC24H},
-
-	{"PIC24HJ32GP204", 0xF1F, 3, PIC24H},
-	{"PIC24HJ32GP202", 0xF1D, 3, PIC24H},
-	{"PIC24HJ16GP304", 0xF17, 3, PIC24H},
-
-	{"PIC24HJ128GP504", 0x67F, 3, PIC24H},
-	{"PIC24HJ128GP502", 0x67D, 3, PIC24H},
-	{"PIC24HJ128GP204", 0x667, 3, PIC24H},
-	{"PIC24HJ128GP202", 0x665, 3, PIC24H},
-	{"PIC24HJ64GP504",  0x677, 3, PIC24H},
-	{"PIC24HJ64GP502",  0x675, 3, PIC24H},
-	{"PIC24HJ64GP204",  0x657, 3, PIC24H},
-	{"PIC24HJ64GP202",  0x655, 3, PIC24H},
-	{"PIC24HJ32GP304",  0x647, 3, PIC24H},
-	{"PIC24HJ32GP302",  0x645, 3, PIC24H},
-
-	{"PIC24FJ64GA006",    0x405, 3, PIC24F},
-	{"PIC24FJ64GA008",    0x408, 3, PIC24F},
-	{"PIC24FJ64GA010",    0x40B, 3, PIC24F},
-	{"PIC24FJ96GA006",    0x406, 3, PIC24F},
-	{"PIC24FJ96GA008",    0x409, 3, PIC24F},
-	{"PIC24FJ96GA010",    0x40C, 3, PIC24F},
-	{"PIC24FJ128GA006",   0x407, 3, PIC24F},
-	{"PIC24FJ128GA008",   0x40A, 3, PIC24F},
-	{"PIC24FJ128GA010",   0x40D, 3, PIC24F},
+	{"dsPIC30F2010",      0x040, 1, dsPIC30F, 0x002000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F2011",      0x0C0, 1, dsPIC30F, 0x002000,  32, 32,    0, 7, 0x000000, 0x000000},
+	{"dsPIC30F2011",      0x240, 1, dsPIC30F, 0x002000,  32, 32,    0, 7, 0x000000, 0x000000},
+	{"dsPIC30F2012",      0x0C2, 1, dsPIC30F, 0x002000,  32, 32,    0, 7, 0x000000, 0x000000},
+	{"dsPIC30F2012",      0x241, 1, dsPIC30F, 0x002000,  32, 32,    0, 7, 0x000000, 0x000000},
+	{"dsPIC30F3010",      0x1C0, 1, dsPIC30F, 0x004000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F3011",      0x1C1, 1, dsPIC30F, 0x004000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F3012",      0x0C1, 1, dsPIC30F, 0x004000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F3013",      0x0C3, 1, dsPIC30F, 0x004000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F3014",      0x160, 1, dsPIC30F, 0x004000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F4011",      0x101, 1, dsPIC30F, 0x008000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F4012",      0x100, 1, dsPIC30F, 0x008000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F4013",      0x141, 1, dsPIC30F, 0x008000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F5011",      0x080, 1, dsPIC30F, 0x00B000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F5013",      0x081, 1, dsPIC30F, 0x00B000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F5015",      0x200, 1, dsPIC30F, 0x00B000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F5016",      0x201, 1, dsPIC30F, 0x00B000,  32, 32, 1024, 7, 0x000000, 0x000000},
+	{"dsPIC30F6010",      0x188, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6010A",     0x281, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6011",      0x192, 1, dsPIC30F, 0x016000,  32, 32, 2048, 7, 0x000000, 0x000000},
+	{"dsPIC30F6011A",     0x2C0, 1, dsPIC30F, 0x016000,  32, 32, 2048, 7, 0x000000, 0x000000},
+	{"dsPIC30F6012",      0x193, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6012A",     0x2C2, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6013",      0x197, 1, dsPIC30F, 0x016000,  32, 32, 2048, 7, 0x000000, 0x000000},
+	{"dsPIC30F6013A",     0x2C1, 1, dsPIC30F, 0x016000,  32, 32, 2048, 7, 0x000000, 0x000000},
+	{"dsPIC30F6014",      0x198, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6014A",     0x2C3, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+	{"dsPIC30F6015",      0x280, 1, dsPIC30F, 0x018000,  32, 32, 4096, 7, 0x000000, 0x000000},
+
+	{"dsPIC33FJ64GP206",  0xC1, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP306",  0xCD, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP310",  0xCF, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP706",  0xD5, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP708",  0xD6, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP710",  0xD7, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP206", 0xD9, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP306", 0xE5, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP310", 0xE7, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP706", 0xED, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP708", 0xEE, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP710", 0xEF, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ256GP506", 0xF5, 3, dsPIC33F, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ256GP510", 0xF7, 3, dsPIC33F, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ256GP710", 0xFF, 3, dsPIC33F, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC506",  0x89, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC508",  0x8A, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC510",  0x8B, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC706",  0x91, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC710",  0x97, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC506", 0xA1, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC510", 0xA3, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC706", 0xA9, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC708", 0xAE, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC710", 0xAF, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ256MC510", 0xB7, 3, dsPIC33F, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ256MC710", 0xBF, 3, dsPIC33F, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"dsPIC33FJ12GP201", 0x802, 3, dsPIC33F, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ12GP202", 0x803, 3, dsPIC33F, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ12MC201", 0x800, 3, dsPIC33F, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ12MC202", 0x801, 3, dsPIC33F, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"dsPIC33FJ32GP204", 0xF0F, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32GP202", 0xF0D, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16GP304", 0xF07, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32MC204", 0xF0B, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32MC202", 0xF09, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16MC304", 0xF03, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"dsPIC33FJ128GP804", 0x62F, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP802", 0x62D, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP204", 0x627, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128GP202", 0x625, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP804",  0x61F, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP802",  0x61D, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP204",  0x617, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64GP202",  0x615, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32GP304",  0x607, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32GP302",  0x605, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC804", 0x62B, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC802", 0x629, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC204", 0x623, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ128MC202", 0x621, 3, dsPIC33F, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC804",  0x61B, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC802",  0x619, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC204",  0x613, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ64MC202",  0x611, 3, dsPIC33F, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32MC304",  0x603, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ32MC302",  0x601, 3, dsPIC33F, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"dsPIC33FJ06GS101",  0xC00, 3, dsPIC33F, 0x001000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ06GS102",  0xC01, 3, dsPIC33F, 0x001000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ06GS202",  0xC02, 3, dsPIC33F, 0x001000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16GS402",  0xC04, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16GS404",  0xC06, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16GS502",  0xC03, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"dsPIC33FJ16GS504",  0xC05, 3, dsPIC33F, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"PIC24HJ64GP206",    0x41, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP210",    0x47, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP506",    0x49, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP510",    0x4B, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP206",   0x5D, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP210",   0x5F, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP306",   0x65, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP310",   0x67, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP506",   0x61, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP510",   0x63, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ256GP206",   0x71, 3, PIC24H, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ256GP210",   0x73, 3, PIC24H, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ256GP610",   0x7B, 3, PIC24H, 0x02AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"PIC24HJ12GP201", 0x80A, 3, PIC24H, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ12GP202", 0x80B, 3, PIC24H, 0x002000, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"PIC24HJ32GP204", 0xF1F, 3, PIC24H, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ32GP202", 0xF1D, 3, PIC24H, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ16GP304", 0xF17, 3, PIC24H, 0x002C00, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"PIC24HJ128GP504", 0x67F, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP502", 0x67D, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP204", 0x667, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ128GP202", 0x665, 3, PIC24H, 0x015800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP504",  0x677, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP502",  0x675, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP204",  0x657, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ64GP202",  0x655, 3, PIC24H, 0x00AC00, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ32GP304",  0x647, 3, PIC24H, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+	{"PIC24HJ32GP302",  0x645, 3, PIC24H, 0x005800, 512, 64,    0, 8, 0x000400, 0x000C00},
+
+	{"PIC24FJ64GA006",    0x405, 3, PIC24F, 0x00AC00, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ64GA008",    0x408, 3, PIC24F, 0x00AC00, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ64GA010",    0x40B, 3, PIC24F, 0x00AC00, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ96GA006",    0x406, 3, PIC24F, 0x010000, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ96GA008",    0x409, 3, PIC24F, 0x010000, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ96GA010",    0x40C, 3, PIC24F, 0x010000, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ128GA006",   0x407, 3, PIC24F, 0x015800, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ128GA008",   0x40A, 3, PIC24F, 0x015800, 512, 64,    0, 0, 0x000000, 0x000000},
+	{"PIC24FJ128GA010",   0x40D, 3, PIC24F, 0x015800, 512, 64,    0, 0, 0x000000, 0x000000},
 
 	{NULL, 0, 0}
 };
@@ -168,14 +224,28 @@ sDevice Device[] =
 /******************************************************************************/
 int _tmain(int argc, _TCHAR* argv[])
 {
-	HANDLE   ComDev ;
-	cmd_cCmd ProgCommand(argv, "i:b:p:e:");
+	lnk_cLink * pLink;
+	cmd_cCmd ProgCommand(argv, "i:b:p:e:tc:fw:sm:k:l:qvd:r");
 	char *   pInterfaceName = NULL;
 	char *   pReadPMAddress = NULL;
 	char *   pReadEEAddress = NULL;
+	char *   pDumpArg       = NULL;
 	char *   pBaudRate      = "115200";
-	FILE *   pFile          = NULL;
-	eFamily  Family;
+	char *   pFileName      = NULL;
+	char *   pCacheDir      = NULL;
+	char *   pEmulateName   = NULL;
+	char *   pSuiteName     = NULL;
+	char *   pLogName       = NULL;
+	bool     bBenchmark     = FALSE;
+	bool     bFullWrite     = FALSE;
+	bool     bStats         = FALSE;
+	bool     bFixedBaud     = FALSE;
+	bool     bQuiet         = FALSE;
+	bool     bVerify        = FALSE;
+	bool     bDone;
+	int      Caps;
+	const sDevice * pDevice;
+	int      Window         = DEFAULT_WINDOW;
 
 	while (ProgCommand.Next())
 	{
@@ -251,210 +321,989 @@ int _tmain(int argc, _TCHAR* argv[])
 		
 				break;
 
-			case '.':
-				if ((pFile = fopen(ProgCommand.Arg(), "r")) == NULL)
-				{
-					printf("\nCan't open file: %s\n", ProgCommand.Arg());
-					return 0;
-				}
+			case 'c': /* Firmware image cache directory */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-c requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					pCacheDir = ProgCommand.Arg();
+				}
+		
+				break;
+
+			case 'w': /* Rows in flight */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-w requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					Window = atoi(ProgCommand.Arg());
+				}
+		
+				break;
+
+			case 'm': /* Emulate a bootloader */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-m requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					pEmulateName = ProgCommand.Arg();
+				}
+		
+				break;
+
+			case 'k': /* Benchmark suite */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-k requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					pSuiteName = ProgCommand.Arg();
+				}
+		
+				break;
+
+			case 'l': /* Telemetry log */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-l requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					pLogName = ProgCommand.Arg();
+				}
+		
+				break;
+
+			case 'q': /* No progress output */
+				bQuiet = TRUE;
+		
+				break;
+
+			case 'd': /* Dump Program Memory to a file */
+				if (ProgCommand.Arg() == NULL)
+				{
+					printf("\n-d requires argument\n");
+					PrintUsage();
+					return 0;
+				}
+				else
+				{
+					pDumpArg = ProgCommand.Arg();
+				}
+		
+				break;
+
+			case 'v': /* Verify the target against the hex file */
+				bVerify = TRUE;
+		
+				break;
+
+			case 'f': /* Write every row, changed or not */
+				bFullWrite = TRUE;
+		
+				break;
+
+			case 'r': /* Report the target's page write times */
+				bStats = TRUE;
+		
+				break;
+
+			case 's': /* Stay at the -b baudrate */
+				bFixedBaud = TRUE;
+		
+				break;
+
+			case 't': /* Time hex file decoding */
+				bBenchmark = TRUE;
+		
+				break;
+
+			case '.':
+				pFileName = ProgCommand.Arg();
+
+				break;
+
+			default:
+				printf("\nUnknown option `%c'\n", ProgCommand.Option());
+				PrintUsage();
+				return 0;
+		}
+	}
+
+	tel_SetQuiet(bQuiet);
+
+	/* Process hex decoding benchmark and exit, no target required */
+	if(bBenchmark == TRUE)
+	{
+		if(pFileName == NULL)
+		{
+			printf("\nPlease provide HEX file name to read\n");
+			PrintUsage();
+			return 0;
+		}
+
+		hex_Benchmark(pFileName);
+		return 0;
+	}
+
+	/* Run the benchmark suite against the emulator, failing on a regression */
+	if(pSuiteName != NULL)
+	{
+		return((Benchmark(pSuiteName, pBaudRate, bFixedBaud, Window) == TRUE) ? 0 : 1);
+	}
+
+	/* Serve as a bootloader until killed, no target required */
+	if(pEmulateName != NULL)
+	{
+		emu_Serve(pEmulateName);
+		return 0;
+	}
+
+	if(pInterfaceName == NULL)
+	{
+		printf("\nPlease use -i option to specify interface name: COM1, COM2, etc...\n");
+		PrintUsage();
+		return 0;
+	}
+
+	/* Program the targets on a comma separated list of ports all at once */
+	if(strchr(pInterfaceName, ',') != NULL)
+	{
+		sGang    Gang;
+		tel_cLog Log;
+
+		if(pFileName == NULL)
+		{
+			printf("\nPlease provide HEX file name to read\n");
+			PrintUsage();
+			return 0;
+		}
+
+		Gang.pFileName  = pFileName;
+		Gang.pCacheDir  = pCacheDir;
+		Gang.pBaudRate  = pBaudRate;
+		Gang.bFixedBaud = bFixedBaud;
+		Gang.bFullWrite = bFullWrite;
+		Gang.bStats     = bStats;
+		Gang.Window     = Window;
+		Gang.pLog       = NULL;
+
+		if(pLogName != NULL)
+		{
+			if(Log.Open(pLogName) != TRUE)
+			{
+				printf("\nCan't open log file: %s\n", pLogName);
+				return 0;
+			}
+
+			Gang.pLog = &Log;
+		}
+
+		return((ProgramGang(&Gang, pInterfaceName) == TRUE) ? 0 : 1);
+	}
+
+
+
+	if((pLink = lnk_Open(pInterfaceName, pBaudRate)) == NULL)
+	{
+		printf("\nCan't open %s\n", pInterfaceName);
+		return 0;
+	}
+
+	tel_cSession Session(pLink);
+	tel_cLog     Log;
+
+	if(bQuiet == FALSE)
+	{
+		Session.AddSink(tel_Progress, NULL);
+	}
+
+	if(pLogName != NULL)
+	{
+		if(Log.Open(pLogName) != TRUE)
+		{
+			printf("\nCan't open log file: %s\n", pLogName);
+			return 0;
+		}
+
+		Session.AddSink(tel_cLog::Write, &Log);
+	}
+
+	if(Connect(pLink, atoi(pBaudRate), bFixedBaud, &Caps, &pDevice, &Window, &Session) != TRUE)
+	{
+		delete pLink;
+		return 0;
+	}
+
+	if(bFullWrite == TRUE)
+	{
+		Caps &= ~CAPS_READ_CRC;
+	}
+
+	if(bStats == FALSE)
+	{
+		Caps &= ~CAPS_READ_STATS;
+	}
+
+	/* Process Dump PM request and exit */
+	if(pDumpArg != NULL)
+	{
+		bDone = DumpPM(pLink, pDumpArg, pDevice, Caps, Window, &Session);
+
+		Session.Finish(bDone);
+
+		delete pLink;
+
+		return((bDone == TRUE) ? 0 : 1);
+	}
+
+	/* Process Read PM request and exit */
+	if(pReadPMAddress != NULL)
+	{
+		return((ReadPM(pLink, pReadPMAddress, pDevice, Caps) == TRUE) ? 0 : 1);
+	}
+	
+	/* Process Read EEPROM request and exit */
+	if(pReadEEAddress != NULL)
+	{
+		return((ReadEE(pLink, pReadEEAddress, pDevice, Caps) == TRUE) ? 0 : 1);
+	}
+
+	/* Read Hex file and transfer it to target */
+	if(pFileName == NULL)
+	{
+		printf("\nPlease provide HEX file name to read\n");
+		PrintUsage();
+		return 0;
+	}
+
+	/* Compare the target with the Hex file and exit, non-zero if it differs */
+	if(bVerify == TRUE)
+	{
+		bDone = VerifyHexFile(pLink, pFileName, pCacheDir, pDevice, Caps, &Session);
+
+		Session.Finish(bDone);
+
+		delete pLink;
+
+		return((bDone == TRUE) ? 0 : 1);
+	}
+
+	bDone = SendHexFile(pLink, pFileName, pCacheDir, pDevice, Caps, Window, &Session);
+
+	Session.Finish(bDone);
+
+	delete pLink;
+
+	return((bDone == TRUE) ? 0 : 1);
+}
+/******************************************************************************/
+bool SendHexFile(lnk_cLink *pLink, char * pFileName, char * pCacheDir, const sDevice * pDevice, int Caps, int Window, tel_cSession * pSession)
+{
+	/* Returns TRUE once the target has been programmed and reset, telling
+	   pSession as it goes from phase to phase. The target is programmed
+	   while the hex file is still being read. */
+	sLoader         Loader;
+	mem_cMemImage * pImage;
+	bool            bDone;
+
+	pImage = StartLoad(&Loader, pFileName, pCacheDir, pDevice, pSession);
+
+	bDone = ProgramImage(pLink, pImage, Caps, Window, pSession);
+
+	JoinLoad(&Loader);
+
+	if(pImage->Failed() != TRUE)
+	{
+		pImage->PrintUsage();
+	}
+
+	delete pImage;
+
+	return(bDone);
+}
+/******************************************************************************/
+#ifdef _WIN32
+static unsigned __stdcall LoadThread(void * pParam)
+#else
+static void * LoadThread(void * pParam)
+#endif
+{
+	LoadHexFile((sLoader *)pParam);
+
+	return 0;
+}
+/******************************************************************************/
+mem_cMemImage * StartLoad(sLoader * pLoader, char * pFileName, char * pCacheDir, const sDevice * pDevice, tel_cSession * pSession)
+{
+	/* Returns an image that fills in behind the caller's back, so it can be
+	   sent as it is read. A cached image is taken straight away; a hex file
+	   is parsed on a thread of its own until JoinLoad. */
+	mem_cMemImage * pImage = new mem_cMemImage(pDevice);
+
+	pLoader->pFileName = pFileName;
+	pLoader->pCacheDir = pCacheDir;
+	pLoader->pImage    = pImage;
+	pLoader->pSession  = pSession;
+	pLoader->bThread   = FALSE;
+
+	tel_Print("\nReading HexFile");
+
+	pImage->BeginLoad();
+
+	if(pSession != NULL)
+	{
+		pSession->Begin(PhaseParse);
+	}
+
+	if(pCacheDir != NULL)
+	{
+		CreateDirectory(pCacheDir, NULL);
+
+		pLoader->SourceHash = xfw_HashFile(pFileName);
+		xfw_CachePath(pLoader->CachePath, pCacheDir, pLoader->SourceHash, pDevice);
+
+		if(xfw_Load(pLoader->CachePath, pLoader->SourceHash, pDevice, pImage) == TRUE)
+		{
+			tel_Print(" (cached)");
+
+			pImage->EndLoad(TRUE);
+
+			if(pSession != NULL)
+			{
+				pSession->End(PhaseParse);
+			}
+
+			return(pImage);
+		}
+	}
+
+	pLoader->bThread = TRUE;
+
+#ifdef _WIN32
+	pLoader->Thread = (HANDLE)_beginthreadex(NULL, 0, LoadThread, pLoader, 0, NULL);
+	assert(pLoader->Thread != 0);
+#else
+	int Result = pthread_create(&pLoader->Thread, NULL, LoadThread, pLoader);
+	assert(Result == 0);
+#endif
+
+	return(pImage);
+}
+/******************************************************************************/
+void JoinLoad(sLoader * pLoader)
+{
+	if(pLoader->bThread != TRUE)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	WaitForSingleObject(pLoader->Thread, INFINITE);
+	CloseHandle(pLoader->Thread);
+#else
+	pthread_join(pLoader->Thread, NULL);
+#endif
+
+	pLoader->bThread = FALSE;
+}
+/******************************************************************************/
+bool LoadHexFile(sLoader * pLoader)
+{
+	/* Parses and formats the hex file into the loader's image, which
+	   publishes rows as they are completed, and caches it. Returns FALSE if
+	   the file can't be read. */
+	mem_cMemImage * pImage   = pLoader->pImage;
+	tel_cSession  * pSession = pLoader->pSession;
+	bool            bLoaded;
+
+	bLoaded = hex_LoadFile(pLoader->pFileName, pImage);
+
+	if(pSession != NULL)
+	{
+		pSession->End(PhaseParse);
+	}
+
+	if(bLoaded != TRUE)
+	{
+		pImage->EndLoad(FALSE);
+		return(FALSE);
+	}
+
+	if(pSession != NULL)
+	{
+		pSession->Begin(PhaseFormat);
+	}
+
+	pImage->FormatData();
+	pImage->EndLoad(TRUE);
+
+	if(pSession != NULL)
+	{
+		pSession->End(PhaseFormat);
+	}
+
+	if((pLoader->pCacheDir != NULL) && (xfw_Save(pLoader->CachePath, pLoader->SourceHash, pImage->Device(), pImage) != TRUE))
+	{
+		printf("\nCan't write cache file: %s\n", pLoader->CachePath);
+	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+bool ProgramImage(lnk_cLink *pLink, mem_cMemImage * pImage, int Caps, int Window, tel_cSession * pSession)
+{
+	/* Programs a formatted image into the target and resets it. The image
+	   is only read, so one can be shared by several targets at once. */
+	mem_cMemImage Memory(pImage);
+	bool          bSent;
+
+	/* Preserve first two locations for bootloader */
+	pSession->Begin(PhasePreserve);
+
+	tel_Print("\nReading Target\n");
+
+	bSent = PreserveResetVector(pLink, Caps, &Memory);
+
+	pSession->End(PhasePreserve);
+
+	if(bSent != TRUE)
+	{
+		return(FALSE);
+	}
+
+	tel_Print("\nProgramming Device ");
+
+	pSession->Begin(PhaseProgram);
+
+	Memory.SetTelemetry(pSession);
+
+	bSent = Memory.SendData(pLink, Caps, Window);
+
+	pSession->End(PhaseProgram);
+
+	if(bSent != TRUE)
+	{
+		return(FALSE);
+	}
+
+	/* Read before the reset clears them */
+	if(Caps & CAPS_READ_STATS)
+	{
+		PrintStats(pLink, Caps);
+	}
+	
+	ResetTarget(pLink, Caps, pSession);
+
+	tel_Print(" Done.\n");
+
+	if((pSession->Unwritten() > 0) || (pSession->Unerased() > 0))
+	{
+		tel_Print("Target left %d pages as they were and wrote %d without an erase\n",
+		          pSession->Unwritten(), pSession->Unerased());
+	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+void ResetTarget(lnk_cLink *pLink, int Caps, tel_cSession * pSession)
+{
+	char Buffer[1];
+
+	pSession->Begin(PhaseReset);
+
+	Buffer[0] = COMMAND_RESET; //Reset target device
+	
+	frm_Request(pLink, Caps, Buffer, 1, NULL, 0);
+
+	Sleep(100);
+
+	pSession->End(PhaseReset);
+}
+/******************************************************************************/
+void PrintStats(lnk_cLink *pLink, int Caps)
+{
+	/* Pages the target has written since it was reset, with the slowest
+	   and total time it spent writing them, then the same for the pages it
+	   erased, before writing them or to leave them blank. The reply is two
+	   such sets of a u16 count and two u32 times */
+	char         Buffer[20];
+	int          Pages;
+	unsigned int MaxUs;
+	unsigned int TotalUs;
+	int          Erases;
+	unsigned int EraseMaxUs;
+	unsigned int EraseTotalUs;
+
+	Buffer[0] = COMMAND_READ_STATS;
+
+	if(frm_Request(pLink, Caps, Buffer, 1, Buffer, 20) != TRUE)
+	{
+		return;
+	}
+
+	Pages        = (unsigned char)Buffer[0] | ((unsigned char)Buffer[1] << 8);
+	MaxUs        = (unsigned char)Buffer[2] | ((unsigned char)Buffer[3] << 8) | ((unsigned char)Buffer[4] << 16) | ((unsigned int)(unsigned char)Buffer[5] << 24);
+	TotalUs      = (unsigned char)Buffer[6] | ((unsigned char)Buffer[7] << 8) | ((unsigned char)Buffer[8] << 16) | ((unsigned int)(unsigned char)Buffer[9] << 24);
+	Erases       = (unsigned char)Buffer[10] | ((unsigned char)Buffer[11] << 8);
+	EraseMaxUs   = (unsigned char)Buffer[12] | ((unsigned char)Buffer[13] << 8) | ((unsigned char)Buffer[14] << 16) | ((unsigned int)(unsigned char)Buffer[15] << 24);
+	EraseTotalUs = (unsigned char)Buffer[16] | ((unsigned char)Buffer[17] << 8) | ((unsigned char)Buffer[18] << 16) | ((unsigned int)(unsigned char)Buffer[19] << 24);
+
+	if(Pages == 0)
+	{
+		printf("\nTarget wrote no pages\n");
+	}
+	else
+	{
+		printf("\nTarget wrote %d pages in %.1f ms, %.2f ms a page on average and %.2f ms at most\n",
+		       Pages, TotalUs / 1000.0, TotalUs / 1000.0 / Pages, MaxUs / 1000.0);
+	}
+
+	if(Erases != 0)
+	{
+		printf("Target erased %d pages in %.1f ms, %.2f ms a page on average and %.2f ms at most\n",
+		       Erases, EraseTotalUs / 1000.0, EraseTotalUs / 1000.0 / Erases, EraseMaxUs / 1000.0);
+	}
+}
+/******************************************************************************/
+bool PreserveResetVector(lnk_cLink *pLink, int Caps, mem_cMemImage * pMemory)
+{
+	/* The first two locations jump to the bootloader: reads them from the
+	   target and patches them into row 0 of pMemory */
+	char Buffer[PM33F_ROW_SIZE * 3];
+	char Data[6];
+	int  RowSize = pMemory->Device()->PageSize;
+
+	Buffer[0] = COMMAND_READ_PM;
+	Buffer[1] = 0x00;
+	Buffer[2] = 0x00;
+	Buffer[3] = 0x00;
+
+	if(frm_Request(pLink, Caps, Buffer, 4, Buffer, RowSize * 3) != TRUE)
+	{
+		return(FALSE);
+	}
+	
+	/* Read back most significant byte first, sent least significant first */
+	Data[0] = Buffer[2];
+	Data[1] = Buffer[1];
+	Data[2] = Buffer[0];
+	Data[3] = Buffer[5];
+	Data[4] = Buffer[4];
+	Data[5] = Buffer[3];
+
+	pMemory->PatchData(0x000000, Data, 2);
+
+	return(TRUE);
+}
+/******************************************************************************/
+bool VerifyHexFile(lnk_cLink *pLink, char * pFileName, char * pCacheDir, const sDevice * pDevice, int Caps, tel_cSession * pSession)
+{
+	/* Checks the program memory of the target against the hex file with
+	   CRCs computed on both sides, without reading the flash back or
+	   writing anything. Returns TRUE if every row matches. */
+	sLoader         Loader;
+	mem_cMemImage * pImage;
+	int             Differ = -1;
+
+	pImage = StartLoad(&Loader, pFileName, pCacheDir, pDevice, pSession);
+
+	JoinLoad(&Loader);
+
+	if(pImage->Failed() != TRUE)
+	{
+		mem_cMemImage Memory(pImage);
+
+		pImage->PrintUsage();
+
+		pSession->Begin(PhaseVerify);
+
+		tel_Print("\nVerifying Device");
+
+		if(PreserveResetVector(pLink, Caps, &Memory) == TRUE)
+		{
+			Differ = Memory.Verify(pLink, Caps);
+		}
+
+		pSession->End(PhaseVerify);
+
+		/* Back to the application, as after programming */
+		ResetTarget(pLink, Caps, pSession);
+
+		if(Differ < 0)
+		{
+			printf("\nTarget can't be verified, its bootloader computes no CRCs\n");
+		}
+		else if(Differ > 0)
+		{
+			printf("\n%d program rows differ from %s\n", Differ, pFileName);
+		}
+		else
+		{
+			tel_Print(" Done, target matches the hex file\n");
+		}
+	}
+
+	delete pImage;
+
+	return(Differ == 0);
+}
+/******************************************************************************/
+#ifdef _WIN32
+static unsigned __stdcall GangThread(void * pParam)
+#else
+static void * GangThread(void * pParam)
+#endif
+{
+	/* Programs one port of a gang */
+	sGangPort     * pPort   = (sGangPort *)pParam;
+	sGang         * pGang   = pPort->pGang;
+	double          Start   = bch_Now();
+	mem_cMemImage * pImage  = NULL;
+	lnk_cLink     * pLink;
+	int             Caps;
+	int             Window  = pGang->Window;
+	const sDevice * pDevice;
+
+	if((pLink = lnk_Open(pPort->pName, pGang->pBaudRate)) == NULL)
+	{
+		printf("%-12s FAILED, can't open the port\n", pPort->pName);
+		return 0;
+	}
+
+	tel_cSession Session(pLink);
+
+	Session.SetName(pPort->pName);
 
-				break;
+	if(pGang->pLog != NULL)
+	{
+		Session.AddSink(tel_cLog::Write, pGang->pLog);
+	}
 
-			default:
-				printf("\nUnknown option `%c'\n", ProgCommand.Option());
-				PrintUsage();
-				return 0;
+	if(Connect(pLink, atoi(pGang->pBaudRate), pGang->bFixedBaud, &Caps, &pDevice, &Window, &Session) == TRUE)
+	{
+		/* The first port to identify its target parses the image for all */
+		EnterCriticalSection(&pGang->Lock);
+
+		if(pGang->bLoaded == FALSE)
+		{
+			/* No session: the load may outlast this port */
+			pGang->pImage  = StartLoad(&pGang->Loader, pGang->pFileName, pGang->pCacheDir, pDevice, NULL);
+			pGang->pDevice = pDevice;
+			pGang->bLoaded = TRUE;
+		}
+
+		if(pGang->pDevice == pDevice)
+		{
+			pImage = pGang->pImage;
+		}
+
+		LeaveCriticalSection(&pGang->Lock);
+
+		if(pImage == NULL)
+		{
+			printf("%-12s device %s differs from %s being programmed\n", pPort->pName, pDevice->pName, pGang->pDevice->pName);
+		}
+
+		if(pGang->bFullWrite == TRUE)
+		{
+			Caps &= ~CAPS_READ_CRC;
+		}
+
+		if(pGang->bStats == FALSE)
+		{
+			Caps &= ~CAPS_READ_STATS;
+		}
+
+		if(pImage != NULL)
+		{
+			pPort->bDone = ProgramImage(pLink, pImage, Caps, Window, &Session);
 		}
 	}
 
-	if(pInterfaceName == NULL)
+	Session.Finish(pPort->bDone);
+
+	pPort->BytesOut = pLink->BytesOut();
+	pPort->Us       = bch_Now() - Start;
+
+	printf("%-12s %s in %.2f s, %d bytes sent\n", pPort->pName, (pPort->bDone == TRUE) ? "programmed" : "FAILED", pPort->Us / 1000000, pPort->BytesOut);
+
+	delete pLink;
+
+	return 0;
+}
+/******************************************************************************/
+bool ProgramGang(sGang * pGang, char * pPortNames)
+{
+	/* Programs the same image into the target on every port of a comma
+	   separated list, a thread to each port. The image is parsed and
+	   formatted once and shared read-only by all the ports, so adding a
+	   port adds only its own link traffic. Returns TRUE if every port was
+	   programmed. */
+	sGangPort Ports[GANG_MAX_PORTS];
+	int       Count    = 0;
+	int       Done     = 0;
+	int       BytesOut = 0;
+	double    Start    = bch_Now();
+	double    Us;
+
+	for(char * pName = strtok(pPortNames, ","); (pName != NULL) && (Count < GANG_MAX_PORTS); pName = strtok(NULL, ","))
 	{
-		printf("\nPlease use -i option to specify interface name: COM1, COM2, etc...\n");
-		PrintUsage();
-		return 0;
+		Ports[Count].pName    = pName;
+		Ports[Count].pGang    = pGang;
+		Ports[Count].bDone    = FALSE;
+		Ports[Count].BytesOut = 0;
+		Ports[Count].Us       = 0;
+		Count++;
 	}
 
+	InitializeCriticalSection(&pGang->Lock);
 
+	pGang->pImage  = NULL;
+	pGang->bLoaded = FALSE;
 
-	assert(OpenConnection(&ComDev, pInterfaceName, pBaudRate) != NULL);
+	/* progress from many ports at once would only be noise */
+	tel_SetQuiet(TRUE);
 
-	/* Read Device ID */
-	Family = ReadID(&ComDev);
+	printf("\nProgramming %d ports\n\n", Count);
 
-	/* Process Read PM request and exit */
-	if(pReadPMAddress != NULL)
+	for(int Port = 0; Port < Count; Port++)
 	{
-		ReadPM(&ComDev, pReadPMAddress, Family);
-		return 0;
+#ifdef _WIN32
+		Ports[Port].Thread = (HANDLE)_beginthreadex(NULL, 0, GangThread, &Ports[Port], 0, NULL);
+		assert(Ports[Port].Thread != 0);
+#else
+		int Result = pthread_create(&Ports[Port].Thread, NULL, GangThread, &Ports[Port]);
+		assert(Result == 0);
+#endif
 	}
-	
-	/* Process Read EEPROM request and exit */
-	if(pReadEEAddress != NULL)
+
+	for(int Port = 0; Port < Count; Port++)
 	{
-		ReadEE(&ComDev, pReadEEAddress, Family);
-		return 0;
+#ifdef _WIN32
+		WaitForSingleObject(Ports[Port].Thread, INFINITE);
+		CloseHandle(Ports[Port].Thread);
+#else
+		pthread_join(Ports[Port].Thread, NULL);
+#endif
+
+		if(Ports[Port].bDone == TRUE)
+		{
+			Done++;
+		}
+
+		BytesOut += Ports[Port].BytesOut;
 	}
 
-	/* Read Hex file and transfer it to target */
-	if(pFile == NULL)
+	Us = bch_Now() - Start;
+
+	printf("\n%d of %d ports programmed in %.2f s, %d bytes sent at %.1f KB/s\n", Done, Count, Us / 1000000, BytesOut, BytesOut * 1000000.0 / 1024 / Us);
+
+	if(pGang->bLoaded == TRUE)
 	{
-		printf("\nPlease provide HEX file name to read\n");
-		PrintUsage();
-		return 0;
+		JoinLoad(&pGang->Loader);
 	}
-	SendHexFile(&ComDev, pFile, Family);
-		
 
-	CloseConnection(&ComDev);
+	delete pGang->pImage;
 
- 	return 0;
+	DeleteCriticalSection(&pGang->Lock);
+
+	return(Done == Count);
 }
 /******************************************************************************/
-void SendHexFile(HANDLE *pComDev, FILE * pFile, eFamily Family)
+bool Benchmark(char * pSuiteName, char * pBaudRate, bool bFixedBaud, int Window)
 {
-	char Buffer[BUFFER_SIZE];
-	int  ExtAddr = 0;
+	/* Programs each image of the suite into a fresh emulated target, as -i emu
+	   would, BCH_PASSES times over, and holds the best of the passes to the
+	   image's baseline. Returns FALSE if any image regressed or failed. */
+	bch_cSuite Suite;
+	bool       bPassed = TRUE;
 
-	/* Initialize Memory */
-	mem_cMemRow ** ppMemory = (mem_cMemRow **)malloc(sizeof(mem_cMemRow *) * PM_SIZE + sizeof(mem_cMemRow *) * EE_SIZE + sizeof(mem_cMemRow *) * CM_SIZE);
+	/* the report is the only output */
+	tel_SetQuiet(TRUE);
 
-	for(int Row = 0; Row < PM_SIZE; Row++)
+	if(Suite.Load(pSuiteName) != TRUE)
 	{
-		ppMemory[Row] = new mem_cMemRow(mem_cMemRow::Program, 0x000000, Row, Family);
+		printf("\nCan't open benchmark suite: %s\n", pSuiteName);
+		return(FALSE);
 	}
 
-	for(int Row = 0; Row < EE_SIZE; Row++)
+	for(int Image = 0; Image < Suite.Images(); Image++)
 	{
-		ppMemory[Row + PM_SIZE] = new mem_cMemRow(mem_cMemRow::EEProm, 0x7FF000, Row, Family);
-	}
+		for(int Pass = 0; Pass < BCH_PASSES; Pass++)
+		{
+			lnk_cLoopback * pLink   = new lnk_cLoopback();
+			lnk_cLoopback * pPeer   = new lnk_cLoopback(pLink);
+			emu_cTarget   * pTarget = new emu_cTarget(pPeer);
+			tel_cSession    Session(pLink);
+			bch_sResult     Result;
+			int             Caps;
+			int             RowWindow = Window;
+			const sDevice * pDevice;
+			double          Start;
 
-	for(int Row = 0; Row < CM_SIZE; Row++)
-	{
-		ppMemory[Row + PM_SIZE + EE_SIZE] = new mem_cMemRow(mem_cMemRow::Configuration, 0xF80000, Row, Family);
-	}
-	
-	printf("\nReading HexFile");
+			Result.ParseUs  = 0;
+			Result.FormatUs = 0;
 
-	while(fgets(Buffer, sizeof(Buffer), pFile) != NULL)
-	{
-		int ByteCount;
-		int Address;
-		int RecordType;
+			pTarget->SetCaps(Suite.Caps(Image));
 
-		sscanf(Buffer+1, "%2x%4x%2x", &ByteCount, &Address, &RecordType);
+			Session.AddSink(bch_Collect, &Result);
 
-		if(RecordType == 0)
-		{
-			Address = (Address + ExtAddr) / 2;
-			
-			for(int CharCount = 0; CharCount < ByteCount*2; CharCount += 4, Address++)
+			pLink->SetBaudRate(pTarget->BaudRate());
+			pTarget->Start();
+
+			Start = bch_Now();
+
+			Result.bDone = FALSE;
+
+			if(Connect(pLink, atoi(pBaudRate), bFixedBaud, &Caps, &pDevice, &RowWindow, &Session) == TRUE)
 			{
-				bool bInserted = FALSE;
+				/* The write statistics would add to the bytes on the wire */
+				Caps &= ~CAPS_READ_STATS;
 
-				for(int Row = 0; Row < (PM_SIZE + EE_SIZE + CM_SIZE); Row++)
-				{
-					if((bInserted = ppMemory[Row]->InsertData(Address, Buffer + 9 + CharCount)) == TRUE)
-					{
-						break;
-					}
-				}
+				Result.bDone = SendHexFile(pLink, Suite.Image(Image), NULL, pDevice, Caps, RowWindow, &Session);
+			}
 
-				if(bInserted != TRUE)
-				{
-					printf("Bad Hex file: 0x%xAddress out of range\n", Address);
-					assert(0);
-				}
+			Result.WallUs = bch_Now() - Start;
+
+			Session.Finish(Result.bDone);
+
+			/* closing our end ends the session if it never got its reset */
+			delete pLink;
+
+			pTarget->Join();
+
+			Result.BytesOut = pTarget->BytesIn();
+			Result.BytesIn  = pTarget->BytesOut();
+			Result.Errors   = 0;
+
+			if(Result.bDone == TRUE)
+			{
+				mem_cMemImage Memory(pDevice);
+
+				hex_LoadFile(Suite.Image(Image), &Memory);
+				Memory.FormatData();
+
+				Result.Errors = pTarget->Compare(&Memory);
 			}
-		}
-		else if(RecordType == 1)
-		{
-		}
-		else if(RecordType == 4)
-		{
-			sscanf(Buffer+9, "%4x", &ExtAddr);
 
-			ExtAddr = ExtAddr << 16;
-		}
-		else
-		{
-			assert(!"Unknown hex record type\n");
+			delete pTarget;
+			delete pPeer;
+
+			Suite.Record(Image, &Result);
 		}
 	}
 
-	/* Preserve first two locations for bootloader */
-	{
-		char Data[32];
-		int          RowSize;
+	printf("\n");
 
-		if(Family == dsPIC30F)
-		{
-			RowSize = PM30F_ROW_SIZE;
-		}
-		else
+	for(int Image = 0; Image < Suite.Images(); Image++)
+	{
+		if(Suite.Check(Image) != TRUE)
 		{
-			RowSize = PM33F_ROW_SIZE;
+			bPassed = FALSE;
 		}
+	}
 
-		Buffer[0] = COMMAND_READ_PM;
-		Buffer[1] = 0x00;
-		Buffer[2] = 0x00;
-		Buffer[3] = 0x00;
+	if(Suite.Save() != TRUE)
+	{
+		printf("\nCan't write benchmark suite: %s\n", pSuiteName);
+	}
 
-		WriteCommBlock(pComDev, Buffer, 4);
+	printf("\nBenchmark %s\n", (bPassed == TRUE) ? "passed" : "FAILED");
 
-		Sleep(100);
+	return(bPassed);
+}
+/******************************************************************************/
+bool Connect(lnk_cLink *pLink, int BaudRate, bool bFixedBaud, int * pCaps, const sDevice ** ppDevice, int * pWindow, tel_cSession * pSession)
+{
+	/* Everything between opening the link and programming: capabilities,
+	   baud rate and device ID. Narrows *pWindow to what the target can
+	   take. Returns FALSE if the target doesn't answer or isn't known. */
+	bool bFound;
 
-		printf("\nReading Target\n");
-		ReceiveData(pComDev, Buffer, RowSize * 3);
-		
-		sprintf(Data, "%02x%02x%02x00%02x%02x%02x00",   Buffer[2] & 0xFF,
-														Buffer[1] & 0xFF,
-														Buffer[0] & 0xFF,
-														Buffer[5] & 0xFF,
-														Buffer[4] & 0xFF,
-														Buffer[3] & 0xFF);
+	pSession->Begin(PhaseId);
 
-		ppMemory[0]->InsertData(0x000000, Data);
-		ppMemory[0]->InsertData(0x000001, Data + 4);
-		ppMemory[0]->InsertData(0x000002, Data + 8);
-		ppMemory[0]->InsertData(0x000003, Data + 12);
+	/* Read optional bootloader commands */
+	if((*pCaps = ReadCaps(pLink)) < 0)
+	{
+		pSession->End(PhaseId);
+		printf("\nNo reply from target\n");
+		return(FALSE);
 	}
 
-	for(int Row = 0; Row < (PM_SIZE + EE_SIZE + CM_SIZE); Row++)
+	if((bFixedBaud == FALSE) && (*pCaps & CAPS_SET_BAUD) && (pLink->BaudRate() != 0))
 	{
-		ppMemory[Row]->FormatData();
+		NegotiateBaud(pLink, BaudRate);
 	}
 
-	printf("\nProgramming Device ");
+	/* Read Device ID, everything from here on is framed if supported */
+	bFound = ReadID(pLink, *pCaps, ppDevice);
 
-	for(int Row = 0; Row < (PM_SIZE + EE_SIZE + CM_SIZE); Row++)
+	pSession->End(PhaseId);
+
+	/* Rows can only be streamed if the bootloader can hold us off while it
+	   writes flash */
+	if(((*pCaps & CAPS_FLOW_CONTROL) == 0) || (pLink->SetFlowControl(TRUE) != TRUE))
 	{
-		ppMemory[Row]->SendData(pComDev);
+		*pWindow = 1;
 	}
 
-	
-	Buffer[0] = COMMAND_RESET; //Reset target device
-	
-	WriteCommBlock(pComDev, Buffer, 1);
-
-	Sleep(100);
-
-	printf(" Done.\n");
+	return(bFound);
 }
 /******************************************************************************/
-eFamily ReadID(HANDLE *pComDev)
+bool ReadID(lnk_cLink *pLink, int Caps, const sDevice ** ppDevice)
 {
+	/* Framed bootloaders answer COMMAND_HELLO with the READ_CAPS reply
+	   followed by the device ID. Its option asks bootloaders that know it
+	   to say in each page's acknowledgement whether the page was written,
+	   written without an erase or left as it was. */
 	char                Buffer[BUFFER_SIZE];
 	unsigned short int  DeviceId = 0;
 	unsigned short int  ProcessId = 0;
 
-	Buffer[0] = COMMAND_READ_ID;
+	tel_Print("\nReading Target Device ID");
+
+	if(Caps & CAPS_FRAMED)
+	{
+		Buffer[0] = COMMAND_HELLO;
+		Buffer[1] = HELLO_ACK_PATH;
+
+		if(frm_Request(pLink, Caps, Buffer, 2, Buffer, 11) != TRUE)
+		{
+			return(FALSE);
+		}
 
-	printf("\nReading Target Device ID");
+		memmove(Buffer, Buffer + 3, 8);
+	}
+	else
+	{
+		Buffer[0] = COMMAND_READ_ID;
 
-	WriteCommBlock(pComDev, Buffer, 1);
+		pLink->Write(Buffer, 1);
 
-	ReceiveData(pComDev, Buffer, 8);
+		if(pLink->Receive(Buffer, 8, READ_BUFFER_TIMEOUT) != TRUE)
+		{
+			printf("\nNo reply from target\n");
+			return(FALSE);
+		}
+	}
 
 	DeviceId  = ((Buffer[1] << 8)&0xFF00) | (Buffer[0]&0x00FF);
 	ProcessId = (Buffer[5] >> 4) & 0x0F;
@@ -478,30 +1327,141 @@ eFamily ReadID(HANDLE *pComDev)
 		Count++;
 	}
 
-	assert(bDeviceFound == TRUE);
+	if(bDeviceFound != TRUE)
+	{
+		printf("\nUnknown device (ID: 0x%04x)\n", DeviceId);
+		return(FALSE);
+	}
     
-	printf("..   Found %s (ID: 0x%04x)\n", Device[Count].pName, DeviceId);
+	tel_Print("..   Found %s (ID: 0x%04x)\n", Device[Count].pName, DeviceId);
 
-	return(Device[Count].Family);
+	*ppDevice = &Device[Count];
+
+	return(TRUE);
 
 }
 /******************************************************************************/
-void ReadPM(HANDLE *pComDev, char * pReadPMAddress, eFamily Family)
+int ReadCaps(lnk_cLink *pLink)
 {
-	int          Count;
-	unsigned int ReadAddress;
-	char         Buffer[BUFFER_SIZE];
-	int          RowSize;
+	/* Bootloaders that predate COMMAND_READ_CAPS answer it with a single NACK
+	   and support none of the optional commands. Returns -1 if nothing
+	   answers at all. */
+	char Buffer[4];
+
+	Buffer[0] = COMMAND_READ_CAPS;
+
+	pLink->Write(Buffer, 1);
 
-	if(Family == dsPIC30F)
+	if(pLink->Receive(Buffer, 1, READ_BUFFER_TIMEOUT) != TRUE)
 	{
-		RowSize = PM30F_ROW_SIZE;
+		return -1;
 	}
-	else
+
+	if(Buffer[0] != COMMAND_ACK)
+	{
+		return 0;
+	}
+
+	if(pLink->Receive(Buffer, 2, READ_BUFFER_TIMEOUT) != TRUE)
+	{
+		return -1;
+	}
+
+	tel_Print("..   Bootloader v%d.%d (capabilities: 0x%02x)\n", (Buffer[0] >> 4) & 0x0F, Buffer[0] & 0x0F, Buffer[1] & 0xFF);
+
+	return(Buffer[1] & 0xFF);
+}
+/******************************************************************************/
+int NegotiateBaud(lnk_cLink *pLink, int BaudRate)
+{
+	/* Step down from the fastest rate the FTDI link and the bootloader's high
+	   speed divider both hit within 1.5%. The bootloader only keeps a new rate
+	   once we have seen its capabilities at that rate and acknowledged them,
+	   otherwise both ends drop back to BaudRate and the next one is tried */
+	static const int Rates[] = {2000000, 1000000, 921600, 460800, 230400};
+	char Buffer[5];
+	char Caps[3];
+	int  Count;
+
+	Caps[0] = COMMAND_READ_CAPS;
+
+	pLink->Write(Caps, 1);
+
+	if(pLink->Receive(Caps, 3, READ_BUFFER_TIMEOUT) != TRUE)
 	{
-		RowSize = PM33F_ROW_SIZE;
+		return(BaudRate);
+	}
+
+	for(Count = 0; Count < (int)(sizeof(Rates)/sizeof(Rates[0])); Count++)
+	{
+		if(Rates[Count] <= BaudRate)
+		{
+			break;
+		}
+
+		Buffer[0] = COMMAND_SET_BAUD;
+		Buffer[1] = (char)(Rates[Count]);
+		Buffer[2] = (char)(Rates[Count] >> 8);
+		Buffer[3] = (char)(Rates[Count] >> 16);
+		Buffer[4] = (char)(Rates[Count] >> 24);
+
+		pLink->Write(Buffer, 5);
+
+		if((pLink->Receive(Buffer, 1, READ_BUFFER_TIMEOUT) != TRUE) || (Buffer[0] != COMMAND_ACK))
+		{
+			break;
+		}
+
+		if(pLink->SetBaudRate(Rates[Count]) == TRUE)
+		{
+			/* give the bootloader time to switch its divider */
+			Sleep(10);
+
+			Buffer[0] = COMMAND_READ_CAPS;
+
+			pLink->Write(Buffer, 1);
+
+			if((pLink->Receive(Buffer, 3, 100) == TRUE) && (memcmp(Buffer, Caps, 3) == 0))
+			{
+				Buffer[0] = COMMAND_ACK;
+
+				pLink->Write(Buffer, 1);
+
+				/* Nothing answers the confirmation, and if it was lost the
+				   bootloader has gone back to BaudRate: ask once more */
+				Buffer[0] = COMMAND_READ_CAPS;
+
+				pLink->Write(Buffer, 1);
+
+				if((pLink->Receive(Buffer, 3, 100) == TRUE) && (memcmp(Buffer, Caps, 3) == 0))
+				{
+					tel_Print("..   Switched to %d baud\n", Rates[Count]);
+
+					return(Rates[Count]);
+				}
+			}
+		}
+
+		/* bootloader reverts once it has waited out both the capabilities
+		   request and the confirmation, wait for that plus some margin.
+		   Anything it made of our bytes at the wrong rate is purged */
+		Sleep(2*BAUD_REVERT_TIMEOUT + 100);
+
+		pLink->SetBaudRate(BaudRate);
+
+		pLink->Purge();
 	}
 
+	return(BaudRate);
+}
+/******************************************************************************/
+bool ReadPM(lnk_cLink *pLink, char * pReadPMAddress, const sDevice * pDevice, int Caps)
+{
+	int          Count;
+	unsigned int ReadAddress;
+	char         Buffer[BUFFER_SIZE];
+	int          RowSize = pDevice->PageSize;
+
 	sscanf(pReadPMAddress, "%x", &ReadAddress);
 
 	ReadAddress = ReadAddress - ReadAddress % (RowSize * 2);
@@ -511,9 +1471,10 @@ void ReadPM(HANDLE *pComDev, char * pReadPMAddress, eFamily Family)
 	Buffer[2] = (ReadAddress >> 8) & 0xFF;
 	Buffer[3] = (ReadAddress >> 16) & 0xFF;
 
-	WriteCommBlock(pComDev, Buffer, 4);
-
-	ReceiveData(pComDev, Buffer, RowSize * 3);
+	if(frm_Request(pLink, Caps, Buffer, 4, Buffer, RowSize * 3) != TRUE)
+	{
+		return(FALSE);
+	}
 
 	for(Count = 0; Count < RowSize * 3;)
 	{
@@ -537,16 +1498,81 @@ void ReadPM(HANDLE *pComDev, char * pReadPMAddress, eFamily Family)
 
 		ReadAddress = ReadAddress + 8;
 	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+bool DumpPM(lnk_cLink *pLink, char * pDumpArg, const sDevice * pDevice, int Caps, int Window, tel_cSession * pSession)
+{
+	/* pDumpArg is file[,start[,end]], addresses in hex. The range defaults
+	   to the whole program memory of the target. */
+	char         FileName[MAX_PATH];
+	char       * pRange;
+	unsigned int Start = 0x000000;
+	unsigned int End   = pDevice->PMSize;
+	dmp_cWriter  Writer;
+	double       Began;
+	bool         bRead;
+
+	strncpy(FileName, pDumpArg, MAX_PATH - 1);
+	FileName[MAX_PATH - 1] = '\0';
+
+	if((pRange = strchr(FileName, ',')) != NULL)
+	{
+		*pRange++ = '\0';
+
+		if((sscanf(pRange, "%x,%x", &Start, &End) < 1) || (Start >= End))
+		{
+			printf("\nBad dump range %s\n", pRange);
+			return(FALSE);
+		}
+	}
+
+	if(Writer.Open(FileName) != TRUE)
+	{
+		printf("\nCan't create %s\n", FileName);
+		return(FALSE);
+	}
+
+	tel_Print("\nReading Program Memory 0x%06x to 0x%06x\n", Start, End);
+
+	Began = bch_Now();
+
+	pSession->Begin(PhaseDump);
+
+	bRead = dmp_Dump(pLink, Caps, Window, pDevice, Start, End, &Writer, pSession);
+
+	pSession->End(PhaseDump);
+
+	ResetTarget(pLink, Caps, pSession);
+
+	if(Writer.Close() != TRUE)
+	{
+		printf("\nCan't write %s\n", FileName);
+		return(FALSE);
+	}
+
+	if(bRead == TRUE)
+	{
+		double Seconds = (bch_Now() - Began) / 1000000.0;
+
+		tel_Print(" Done, %d KB read in %.2f s\n", pLink->BytesIn() / 1024, Seconds);
+	}
+
+	return(bRead);
 }
 /******************************************************************************/
-void ReadEE(HANDLE *pComDev, char * pReadEEAddress, eFamily Family)
+bool ReadEE(lnk_cLink *pLink, char * pReadEEAddress, const sDevice * pDevice, int Caps)
 {
 	int          Count;
 	unsigned int ReadAddress;
 	char         Buffer[BUFFER_SIZE];
 
-	assert(Family != dsPIC33F);
-	assert(Family != PIC24H);
+	if(pDevice->EESize == 0)
+	{
+		printf("\n%s has no data EEPROM\n", pDevice->pName);
+		return(FALSE);
+	}
 
 	sscanf(pReadEEAddress, "%x", &ReadAddress);
 
@@ -557,9 +1583,10 @@ void ReadEE(HANDLE *pComDev, char * pReadEEAddress, eFamily Family)
 	Buffer[2] = (ReadAddress >> 8) & 0xFF;
 	Buffer[3] = (ReadAddress >> 16) & 0xFF;
 
-	WriteCommBlock(pComDev, Buffer, 4);
-
-	ReceiveData(pComDev, Buffer, EE30F_ROW_SIZE * 2);
+	if(frm_Request(pLink, Caps, Buffer, 4, Buffer, EE30F_ROW_SIZE * 2) != TRUE)
+	{
+		return(FALSE);
+	}
 
 	for(Count = 0; Count < EE30F_ROW_SIZE * 2;)
 	{
@@ -591,158 +1618,61 @@ void ReadEE(HANDLE *pComDev, char * pReadEEAddress, eFamily Family)
 
 		ReadAddress = ReadAddress + 16;
 	}
+
+	return(TRUE);
 }
 /******************************************************************************/
 void PrintUsage(void)
 {
-	printf("\nUsage: \"16-Bit Flash Programmer.exe\" -i interface [-bpe] hexfile\n\n");
+	printf("\nUsage: \"16-Bit Flash Programmer.exe\" -i interface [-bpecfwslqvr] hexfile\n");
+	printf("       \"16-Bit Flash Programmer.exe\" -i interface -d file[,start[,end]]\n");
+	printf("       \"16-Bit Flash Programmer.exe\" -t hexfile\n");
+	printf("       \"16-Bit Flash Programmer.exe\" -m interface\n");
+	printf("       \"16-Bit Flash Programmer.exe\" -k suite [-bws]\n\n");
 	printf("Options:\n\n");
 	printf("  -i\n");
-	printf("       specifies serial interface name such as COM1, COM2, etc\n\n");
+	printf("       specifies serial interface name such as COM1, COM2, etc, tcp:host:port for a\n");
+	printf("       serial server, emu for the built in bootloader emulator, emu:caps for one\n");
+	printf("       advertising only the given capabilities in hex, or pty to create\n");
+	printf("       a pseudo-terminal (Linux). A comma separated list, such as COM3,COM4,COM5,\n");
+	printf("       programs the target on every port at once\n\n");
 	printf("  -b\n");
 	printf("       specifies baudrate for serial interface. Default is 9600\n\n");
 	printf("  -p\n");
 	printf("       read program flash. Must provide address to read in HEX format: -p 0x000100\n\n");
+	printf("  -d\n");
+	printf("       dump program flash to a file, Intel HEX if its name ends in .hex and raw binary\n");
+	printf("       otherwise. Reads the whole flash, or from start up to but not including end:\n");
+	printf("       -d backup.hex,0x000400,0x00A000\n\n");
 	printf("  -e\n");
 	printf("       read EEPROM. Must provide address to read in HEX format: -e 0x7FFC00\n\n");
-}
-/******************************************************************************/
-void ReceiveData(HANDLE *pComDev, char * pBuffer, int BytesToReceive)
-{
-	int Size = 0;
-
-	while(Size != BytesToReceive)
-	{
-		Size += ReadCommBlock(pComDev, pBuffer + Size, BytesToReceive - Size);
-	}
-}
-/******************************************************************************/
-BOOL WriteCommBlock(HANDLE * pComDev, char *pBuffer , int BytesToWrite)
-{
-	BOOL       bWriteStat   = 0;
-	DWORD      BytesWritten = 0;
-	COMSTAT    ComStat      = {0};
-	OVERLAPPED osWrite      = {0,0,0};
-
-	printf(".");
-
-	if(WriteFile(*pComDev,pBuffer,BytesToWrite,&BytesWritten,&osWrite) == FALSE)
-	{
-		assert(GetLastError() == ERROR_IO_PENDING);
-		return (FALSE);
-	}
-
-	return (TRUE);
-}
-/******************************************************************************/
-int ReadCommBlock(HANDLE *pComDev, char * pBuffer, int MaxLength )
-{
-	DWORD      Length;
-	COMSTAT    ComStat    = {0};
-	DWORD      ErrorFlags = 0;
-	OVERLAPPED osRead     = {0,0,0};
-
-	/* only try to read number of bytes in queue */
-   ClearCommError(*pComDev, &ErrorFlags, &ComStat);
-
-	Length = min((DWORD)MaxLength, ComStat.cbInQue);
-   
-	if(Length > 0)
-	{
-		if(ReadFile(*pComDev, pBuffer, Length, &Length, &osRead) == FALSE)
-		{
-			Length = 0 ;
-
-			ClearCommError(*pComDev, &ErrorFlags, &ComStat);
-
-			assert(ErrorFlags == 0);
-		}
-	}
-	else
-	{
-		Length = 0;
-		Sleep(1);
-	}
-
-	return (Length);
-}
-/******************************************************************************/
-HANDLE OpenConnection(HANDLE * pComDev, char * pPortName, char * pBaudRate)
-{
-	int BaudRate;
-	COMMTIMEOUTS CommTimeOuts;
-   DCB          Dcb;
-
-   sscanf(pBaudRate, "%d", &BaudRate);
-
-	*pComDev = CreateFile(pPortName,
-								  GENERIC_READ | GENERIC_WRITE,
-								  0,
-								  NULL,
-								  OPEN_EXISTING,
-								  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-								  NULL);
-	  
-	if(*pComDev == NULL)
-	{
-		return (*pComDev);
-	}
-
-	/* get any early notifications */
-	SetCommMask(*pComDev, EV_RXCHAR);
-
-	/* setup device buffers */
-	SetupComm(*pComDev, 10000, 10000);
-
-	/* purge any information in the buffer */
-	PurgeComm(*pComDev,  PURGE_TXABORT |
-								PURGE_RXABORT |
-								PURGE_TXCLEAR |
-								PURGE_RXCLEAR);
-
-	/* set up for overlapped I/O */
-	CommTimeOuts.ReadIntervalTimeout         = MAXDWORD;
-	CommTimeOuts.ReadTotalTimeoutMultiplier  = 0;
-	CommTimeOuts.ReadTotalTimeoutConstant    = 0;
-	CommTimeOuts.WriteTotalTimeoutMultiplier = 2*CBR_9600/BaudRate;
-	CommTimeOuts.WriteTotalTimeoutConstant   = 0 ;
-
-	assert(SetCommTimeouts(*pComDev, &CommTimeOuts) == TRUE);
-
-
-	Dcb.DCBlength = sizeof(DCB);
-
-	assert(GetCommState(*pComDev, &Dcb) == TRUE);
-
-	Dcb.BaudRate     = BaudRate;
-	Dcb.ByteSize     = BYTESIZE;
-	Dcb.Parity       = PARITY;
-	Dcb.StopBits     = STOPBITS;
-	Dcb.fOutxDsrFlow = FALSE;
-	Dcb.fDtrControl  = DTR_CONTROL_DISABLE;
-	Dcb.fOutxCtsFlow = FALSE ;
-	Dcb.fRtsControl  = RTS_CONTROL_DISABLE;
-	Dcb.fInX         = FALSE;
-	Dcb.fOutX        = FALSE;
-	//Dcb.XonChar      = ASCII_XON ;
-	//Dcb.XoffChar     = ASCII_XOFF ;
-	Dcb.XonLim       = 0x800;
-	Dcb.XoffLim      = 0x200;
-	Dcb.fBinary      = TRUE ;
-	Dcb.fParity      = TRUE ;
-
-	assert(SetCommState(*pComDev, &Dcb) == TRUE);
-
-	return (*pComDev);
-}
-/******************************************************************************/
-BOOL CloseConnection(HANDLE * pComDev)
-{
-	/* purge any outstanding reads/writes and close device handle */
-	PurgeComm(*pComDev,  PURGE_TXABORT |
-								PURGE_RXABORT |
-								PURGE_TXCLEAR |
-								PURGE_RXCLEAR);
-
-	return(CloseHandle(*pComDev));
+	printf("  -c\n");
+	printf("       cache parsed images in the given directory and reuse them for the same hex file\n\n");
+	printf("  -f\n");
+	printf("       write every row, even rows the target reports as unchanged\n\n");
+	printf("  -w\n");
+	printf("       number of rows sent ahead of their acknowledgement. Default is %d\n\n", DEFAULT_WINDOW);
+	printf("  -s\n");
+	printf("       stay at the -b baudrate instead of switching the bootloader to the fastest rate that works\n\n");
+	printf("  -l\n");
+	printf("       append session telemetry to the given file: phase times and every row sent,\n");
+	printf("       acknowledged or retried, as JSON lines, or CSV if the name ends in .csv\n\n");
+	printf("  -q\n");
+	printf("       quiet, no progress output\n\n");
+	printf("  -r\n");
+	printf("       report how many pages the target wrote and its time to erase and write them\n\n");
+	printf("  -v\n");
+	printf("       verify the target's program memory against the hex file instead of programming it,\n");
+	printf("       comparing CRCs of whole runs of rows; exits non-zero if any row differs\n\n");
+	printf("  -m\n");
+	printf("       emulate the x-IMU bootloader on the given interface, for example pty, instead\n");
+	printf("       of programming a target. pty,0x00 advertises only the given capabilities\n\n");
+	printf("  -k\n");
+	printf("       program every image listed in the suite file into the emulator and compare\n");
+	printf("       wire bytes, parse, format, acknowledgement and total times with the\n");
+	printf("       baselines stored there; exits non-zero if the bytes grow, slower times are\n");
+	printf("       only reported. @dense and @sparse name generated images, as in bch_suite.txt,\n");
+	printf("       and ,0x00 after an image sets the capabilities the emulator advertises\n\n");
+	printf("  -t\n");
+	printf("       time hex file decoding, old sscanf parser against the table decoder\n\n");
 }
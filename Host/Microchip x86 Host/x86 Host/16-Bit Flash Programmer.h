@@ -3,6 +3,12 @@
 
 #define SCI_INTERFACE_NAME "COM"
 
+#ifdef _WIN32
+#define PATH_SEPARATOR "\\"
+#else
+#define PATH_SEPARATOR "/"
+#endif
+
 
 #define BYTESIZE   8
 #define PARITY     NOPARITY
@@ -12,9 +18,11 @@
 
 #define BUFFER_SIZE         4096
 #define READ_BUFFER_TIMEOUT 1000
+#define BAUD_REVERT_TIMEOUT 420 /* bootloader's GetCharTimeout, 0x10000 * 256 cycles at 40 MIPS */
 
 #define PM30F_ROW_SIZE 32
-#define PM33F_ROW_SIZE 64*8
+#define PM33F_ROW_SIZE 64*8 /* a page, the largest program row of any family */
+#define PM33F_WRITE_SIZE 64
 #define EE30F_ROW_SIZE 16
 
 #define COMMAND_NACK     0x00
@@ -27,6 +35,29 @@
 #define COMMAND_WRITE_CM 0x07
 #define COMMAND_RESET    0x08
 #define COMMAND_READ_ID  0x09
+#define COMMAND_READ_CAPS 0x0A
+#define COMMAND_ERASE_PM 0x0B
+#define COMMAND_READ_CRC 0x0C
+#define COMMAND_SET_BAUD 0x0D
+#define COMMAND_WRITE_PM_RLE 0x0E
+#define COMMAND_HELLO    0x0F
+#define COMMAND_CRC_RANGE 0x10
+#define COMMAND_READ_STATS 0x11
+
+#define ACK_UNCHANGED    0x02 /* page already held the data, nothing written */
+#define ACK_NO_ERASE     0x03 /* page was blank, written without an erase */
+#define HELLO_ACK_PATH   0x01 /* COMMAND_HELLO option asking for the two above */
+
+#define CAPS_ERASE_PM    0x01
+#define CAPS_READ_CRC    0x02
+#define CAPS_FLOW_CONTROL 0x04
+#define CAPS_SET_BAUD    0x08
+#define CAPS_WRITE_PM_RLE 0x10
+#define CAPS_FRAMED      0x20
+#define CAPS_CRC_RANGE   0x40
+#define CAPS_READ_STATS  0x80
+
+#define DEFAULT_WINDOW   4
 
 
 enum eFamily
@@ -43,6 +74,13 @@ typedef struct
 	unsigned short int   Id;
 	unsigned short int   ProcessId;
 	eFamily              Family;
+	unsigned int         PMSize;      /* program memory, in addresses */
+	int                  PageSize;    /* instructions erased at once, a program row of the image */
+	int                  RowSize;     /* instructions written at once */
+	int                  EESize;      /* data EEPROM in bytes, ending at EE_END; 0 if none */
+	int                  ConfigWords; /* from CM_START, sent with COMMAND_WRITE_CM */
+	unsigned int         BootStart;   /* program memory holding the bootloader, which */
+	unsigned int         BootEnd;     /* no image may write; none if BootEnd is 0 */
 } sDevice;
 
 
@@ -0,0 +1,433 @@
+/******************************************************************************\
+ *
+ *  bch is the end to end flashing benchmark, run with -k suite. The suite
+ *  file names one reference image per line, each followed by the baseline
+ *  it is held to:
+ *
+ *    # image         out    in  parse format   p50   p90   p99    wall
+ *    ximu.hex      29395   812   2100    450  3300  3500  4100 1642000
+ *    @dense       128570  2688
+ *    @sparse,0x00   9272  1559
+ *
+ *  Bytes are counted on the wire in each direction, everything else is in
+ *  microseconds. Every image is programmed BCH_PASSES times into a fresh
+ *  emulated target and the best figure of the passes is kept. An image
+ *  whose line has no figures yet records them all as its baseline, and the
+ *  suite file is rewritten; delete the figures to take a new baseline. A
+ *  baseline may stop after the byte counts, as in the suite checked in
+ *  beside the sources, whose timings would only hold on one machine.
+ *
+ *  An image named @dense or @sparse is generated rather than read: the
+ *  application flash of the emulated target filled with pseudo random
+ *  instructions, or a short run of them every 0x4000 addresses. It is
+ *  written next to the suite file as bch_dense.hex or bch_sparse.hex.
+ *
+ *  The emulated target advertises every capability unless the image is
+ *  followed by a comma and the capabilities to advertise, in hex, as -i
+ *  emu:caps takes them. 0x00 holds the plain protocol of bootloaders that
+ *  predate them to a baseline of its own.
+ *
+ *  Bytes on the wire come from the emulator and do not vary between runs,
+ *  so any growth is a protocol regression and fails. Timings depend on the
+ *  machine, so past their tolerance they are reported but don't fail. A
+ *  session that does not complete or leaves the target holding anything
+ *  but the image fails outright.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+
+typedef struct
+{
+	const char * pName;
+	double       Unit;      /* printed in microseconds per unit */
+	double       Tolerance; /* fraction above the baseline allowed */
+	double       Slack;     /* and this much more, for noise on short runs */
+} sMetric;
+
+static const sMetric MetricTable[] =
+{
+	{"out",    0,    0.0,  0},
+	{"in",     0,    0.0,  0},
+	{"parse",  1000, 0.5,  2000},
+	{"format", 1000, 0.5,  2000},
+	{"p50",    1000, 0.25, 1000},
+	{"p90",    1000, 0.25, 1000},
+	{"p99",    1000, 0.5,  2000},
+	{"wall",   1000, 0.1,  50000},
+};
+
+/******************************************************************************/
+bool bch_Synthesize(const char * pName, const char * pFileName)
+{
+	/* Writes the synthetic image pName, without its @, as Intel HEX: a goto
+	   to BCH_APP_START, the configuration words, and instructions from a
+	   fixed sequence so the image and its bytes on the wire never change */
+	static const char Goto[6] = {0x04, 0x0C, 0x00, 0x00, 0x00, 0x00};
+	char              Row[PM33F_ROW_SIZE * 3];
+	char              Config[EMU_CM_SIZE * 3];
+	unsigned int      Seed = 1;
+	int               Run;
+	dmp_cWriter       Writer;
+
+	if(strcmp(pName, "dense") == 0)
+	{
+		Run = 0x4000;
+	}
+	else if(strcmp(pName, "sparse") == 0)
+	{
+		Run = BCH_SPARSE_RUN;
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	if(Writer.Open(pFileName) != TRUE)
+	{
+		return FALSE;
+	}
+
+	Writer.Write(0, Goto, 2);
+
+	for(unsigned int Address = BCH_APP_START; Address < EMU_PM_SIZE; Address += PM33F_ROW_SIZE * 2)
+	{
+		int Instructions = min(PM33F_ROW_SIZE, (int)(EMU_PM_SIZE - Address) / 2);
+		int Written      = 0;
+
+		for(int Instruction = 0; Instruction < Instructions; Instruction++)
+		{
+			Seed = Seed * 1103515245 + 12345;
+
+			if((Address + Instruction * 2) % 0x4000 >= (unsigned int)Run)
+			{
+				memset(&Row[Instruction * 3], 0xFF, 3);
+				continue;
+			}
+
+			Row[Instruction * 3 + 0] = (char)(Seed >> 24);
+			Row[Instruction * 3 + 1] = (char)(Seed >> 16);
+			Row[Instruction * 3 + 2] = (char)(Seed >> 8);
+			Written++;
+		}
+
+		if(Written != 0)
+		{
+			Writer.Write(Address, Row, Instructions);
+		}
+	}
+
+	for(int Word = 0; Word < EMU_CM_SIZE; Word++)
+	{
+		Config[Word * 3 + 0] = 0x00;
+		Config[Word * 3 + 1] = (char)0xFF;
+		Config[Word * 3 + 2] = (char)Word;
+	}
+
+	Writer.Write(CM_START, Config, EMU_CM_SIZE);
+
+	return(Writer.Close());
+}
+/******************************************************************************/
+double bch_Now(void)
+{
+	/* microseconds */
+	static LARGE_INTEGER Frequency;
+	LARGE_INTEGER        Counter;
+
+	if(Frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&Frequency);
+	}
+
+	QueryPerformanceCounter(&Counter);
+
+	return (double)Counter.QuadPart * 1000000.0 / (double)Frequency.QuadPart;
+}
+/******************************************************************************/
+void bch_Collect(const tel_sEvent * pEvent, void * pContext)
+{
+	/* Session telemetry sink filling in a bch_sResult */
+	bch_sResult * pResult = (bch_sResult *)pContext;
+
+	if(pEvent->Event == EventRowAcked)
+	{
+		pResult->Latency.Add(pEvent->DurationUs);
+	}
+	else if((pEvent->Event == EventPhaseEnd) && (pEvent->Phase == PhaseParse))
+	{
+		pResult->ParseUs = pEvent->DurationUs;
+	}
+	else if((pEvent->Event == EventPhaseEnd) && (pEvent->Phase == PhaseFormat))
+	{
+		pResult->FormatUs = pEvent->DurationUs;
+	}
+}
+/******************************************************************************/
+bch_cHistogram::bch_cHistogram()
+: m_Count(0),
+  m_Max(0)
+{
+	memset(m_Buckets, 0, sizeof(m_Buckets));
+}
+/******************************************************************************/
+void bch_cHistogram::Add(double Us)
+{
+	int Bucket = (Us > 1.0) ? (int)(log(Us) / log(2.0) * 4.0) : 0;
+
+	m_Buckets[min(Bucket, BCH_BUCKETS - 1)]++;
+	m_Count++;
+	m_Max = max(m_Max, Us);
+}
+/******************************************************************************/
+double bch_cHistogram::Percentile(double Fraction)
+{
+	/* The upper edge of the bucket holding the sample, so at most a fifth
+	   over, and never more than the largest sample */
+	int Rank = max(1, (int)ceil(Fraction * m_Count));
+	int Seen = 0;
+
+	for(int Bucket = 0; Bucket < BCH_BUCKETS; Bucket++)
+	{
+		Seen += m_Buckets[Bucket];
+
+		if(Seen >= Rank)
+		{
+			return min(m_Max, pow(2.0, (Bucket + 1) / 4.0));
+		}
+	}
+
+	return m_Max;
+}
+/******************************************************************************/
+bch_cSuite::bch_cSuite()
+: m_Count(0),
+  m_bChanged(FALSE)
+{
+	m_FileName[0] = '\0';
+}
+/******************************************************************************/
+bool bch_cSuite::Load(const char * pFileName)
+{
+	FILE * pFile;
+	char   Line[MAX_PATH + 256];
+	char   Name[MAX_PATH];
+	char * pCaps;
+
+	if((pFile = fopen(pFileName, "r")) == NULL)
+	{
+		return FALSE;
+	}
+
+	strncpy(m_FileName, pFileName, MAX_PATH - 1);
+	m_FileName[MAX_PATH - 1] = '\0';
+
+	while((fgets(Line, sizeof(Line), pFile) != NULL) && (m_Count < BCH_MAX_IMAGES))
+	{
+		sEntry * pEntry = &m_Entries[m_Count];
+		double * pBase  = pEntry->Baseline;
+		int      Fields;
+
+		Fields = sscanf(Line, "%259s %lf %lf %lf %lf %lf %lf %lf %lf",
+		                pEntry->Path,
+		                &pBase[0], &pBase[1], &pBase[2], &pBase[3],
+		                &pBase[4], &pBase[5], &pBase[6], &pBase[7]);
+
+		if((Fields < 1) || (pEntry->Path[0] == '#'))
+		{
+			continue;
+		}
+
+		pEntry->Figures = Fields - 1;
+		pEntry->bFailed = FALSE;
+		pEntry->Passes  = 0;
+		pEntry->MaxUs   = 0;
+		pEntry->Caps    = EMU_CAPS;
+
+		strcpy(Name, pEntry->Path);
+
+		if((pCaps = strchr(Name, ',')) != NULL)
+		{
+			*pCaps++     = '\0';
+			pEntry->Caps = (int)strtol(pCaps, NULL, 16);
+		}
+
+		if(Name[0] != '@')
+		{
+			strcpy(pEntry->File, Name);
+		}
+		else
+		{
+			const char * pSlash = max(strrchr(pFileName, '/'), strrchr(pFileName, '\\'));
+			int          Folder = (pSlash != NULL) ? (int)(pSlash + 1 - pFileName) : 0;
+
+			pEntry->File[0] = '\0';
+
+			if(Folder + strlen(Name) + 8 < MAX_PATH)
+			{
+				char File[MAX_PATH];
+
+				memcpy(File, pFileName, Folder);
+				strcpy(File + Folder, "bch_");
+				strcat(File, Name + 1);
+				strcat(File, ".hex");
+				strcpy(pEntry->File, File);
+			}
+
+			if((pEntry->File[0] == '\0') || (bch_Synthesize(Name + 1, pEntry->File) != TRUE))
+			{
+				printf("\n%s: can't generate %s\n", pEntry->Path, pEntry->File);
+				pEntry->bFailed = TRUE;
+			}
+		}
+
+		m_Count++;
+	}
+
+	fclose(pFile);
+
+	return TRUE;
+}
+/******************************************************************************/
+bool bch_cSuite::Save(void)
+{
+	FILE * pFile;
+
+	if(m_bChanged == FALSE)
+	{
+		return TRUE;
+	}
+
+	if((pFile = fopen(m_FileName, "w")) == NULL)
+	{
+		return FALSE;
+	}
+
+	fprintf(pFile, "# %-22s", "image");
+
+	for(int Metric = 0; Metric < Metrics; Metric++)
+	{
+		fprintf(pFile, " %8s", MetricTable[Metric].pName);
+	}
+
+	fprintf(pFile, "\n");
+
+	for(int Image = 0; Image < m_Count; Image++)
+	{
+		fprintf(pFile, "%-24s", m_Entries[Image].Path);
+
+		for(int Metric = 0; Metric < m_Entries[Image].Figures; Metric++)
+		{
+			fprintf(pFile, " %8.0f", m_Entries[Image].Baseline[Metric]);
+		}
+
+		fprintf(pFile, "\n");
+	}
+
+	fclose(pFile);
+
+	return TRUE;
+}
+/******************************************************************************/
+void bch_cSuite::Record(int Image, bch_sResult * pResult)
+{
+	/* Keeps the best timing of the passes; byte counts must agree */
+	sEntry * pEntry = &m_Entries[Image];
+	double   Pass[Metrics];
+
+	Pass[BytesOut] = pResult->BytesOut;
+	Pass[BytesIn]  = pResult->BytesIn;
+	Pass[ParseUs]  = pResult->ParseUs;
+	Pass[FormatUs] = pResult->FormatUs;
+	Pass[AckP50Us] = pResult->Latency.Percentile(0.50);
+	Pass[AckP90Us] = pResult->Latency.Percentile(0.90);
+	Pass[AckP99Us] = pResult->Latency.Percentile(0.99);
+	Pass[WallUs]   = pResult->WallUs;
+
+	if((pResult->bDone != TRUE) || (pResult->Errors != 0))
+	{
+		printf("\n%s: %s\n", pEntry->Path, (pResult->bDone != TRUE) ? "programming failed" : "target does not match the image");
+		pEntry->bFailed = TRUE;
+	}
+
+	if(pEntry->Passes == 0)
+	{
+		memcpy(pEntry->Measured, Pass, sizeof(Pass));
+	}
+	else
+	{
+		if((Pass[BytesOut] != pEntry->Measured[BytesOut]) || (Pass[BytesIn] != pEntry->Measured[BytesIn]))
+		{
+			printf("\n%s: bytes on the wire differ between passes\n", pEntry->Path);
+			pEntry->bFailed = TRUE;
+		}
+
+		for(int Metric = ParseUs; Metric < Metrics; Metric++)
+		{
+			pEntry->Measured[Metric] = min(pEntry->Measured[Metric], Pass[Metric]);
+		}
+	}
+
+	pEntry->MaxUs = max(pEntry->MaxUs, pResult->Latency.Max());
+	pEntry->Passes++;
+}
+/******************************************************************************/
+bool bch_cSuite::Check(int Image)
+{
+	/* Prints the image's figures and holds them to its baseline, or takes
+	   them as the baseline if it has none */
+	sEntry * pEntry = &m_Entries[Image];
+
+	printf("\n%-24s", pEntry->Path);
+
+	for(int Metric = 0; Metric < Metrics; Metric++)
+	{
+		if(MetricTable[Metric].Unit == 0)
+		{
+			printf(" %s %.0f", MetricTable[Metric].pName, pEntry->Measured[Metric]);
+		}
+		else
+		{
+			printf(" %s %.2f", MetricTable[Metric].pName, pEntry->Measured[Metric] / MetricTable[Metric].Unit);
+		}
+	}
+
+	printf(" max %.2f (ms)\n", pEntry->MaxUs / 1000);
+
+	if(pEntry->bFailed == TRUE)
+	{
+		return FALSE;
+	}
+
+	if(pEntry->Figures <= BytesIn)
+	{
+		memcpy(pEntry->Baseline, pEntry->Measured, sizeof(pEntry->Baseline));
+		pEntry->Figures = Metrics;
+		m_bChanged      = TRUE;
+
+		printf("  recorded as the baseline\n");
+		return TRUE;
+	}
+
+	for(int Metric = 0; Metric < pEntry->Figures; Metric++)
+	{
+		double Limit = pEntry->Baseline[Metric] * (1 + MetricTable[Metric].Tolerance) + MetricTable[Metric].Slack;
+
+		if(pEntry->Measured[Metric] <= Limit)
+		{
+			continue;
+		}
+
+		if(MetricTable[Metric].Unit == 0)
+		{
+			printf("  regression: %s %.0f against a baseline of %.0f\n", MetricTable[Metric].pName, pEntry->Measured[Metric], pEntry->Baseline[Metric]);
+			pEntry->bFailed = TRUE;
+		}
+		else
+		{
+			printf("  slower: %s %.0f against a baseline of %.0f, not failed as timings vary\n", MetricTable[Metric].pName, pEntry->Measured[Metric], pEntry->Baseline[Metric]);
+		}
+	}
+
+	return(pEntry->bFailed != TRUE);
+}
@@ -0,0 +1,90 @@
+#ifndef _bch_h
+#define _bch_h
+
+#define BCH_BUCKETS    96 /* four to an octave from 1 us, so up to 16 s */
+#define BCH_PASSES     3
+#define BCH_MAX_IMAGES 32
+#define BCH_APP_START  0x000C00 /* first address after the emulated bootloader */
+#define BCH_SPARSE_RUN 0x100    /* addresses written at the start of every 0x4000 by @sparse */
+
+class bch_cHistogram
+{
+public:
+	bch_cHistogram();
+
+	void   Add       (double Us);
+	double Percentile(double Fraction);
+
+	int    Count() { return m_Count; }
+	double Max()   { return m_Max; }
+
+private:
+	int    m_Buckets[BCH_BUCKETS];
+	int    m_Count;
+	double m_Max;
+};
+
+typedef struct
+{
+	bool           bDone;
+	int            Errors;
+	double         ParseUs;
+	double         FormatUs;
+	double         WallUs;
+	int            BytesOut;
+	int            BytesIn;
+	bch_cHistogram Latency;
+} bch_sResult;
+
+class bch_cSuite
+{
+public:
+	bch_cSuite();
+
+	bool   Load  (const char * pFileName);
+	bool   Save  (void);
+	void   Record(int Image, bch_sResult * pResult);
+	bool   Check (int Image);
+
+	int    Images(void)      { return m_Count; }
+	char * Image (int Image) { return m_Entries[Image].File; }
+	int    Caps  (int Image) { return m_Entries[Image].Caps; }
+
+private:
+	enum eMetric
+	{
+		BytesOut,
+		BytesIn,
+		ParseUs,
+		FormatUs,
+		AckP50Us,
+		AckP90Us,
+		AckP99Us,
+		WallUs,
+		Metrics
+	};
+
+	struct sEntry
+	{
+		char   Path[MAX_PATH];
+		char   File[MAX_PATH]; /* programmed, Path unless the image is synthetic */
+		int    Caps;           /* the emulated target advertises */
+		int    Figures;        /* of the baseline, from the start of eMetric */
+		bool   bFailed;
+		int    Passes;
+		double Baseline[Metrics];
+		double Measured[Metrics];
+		double MaxUs;
+	};
+
+	char   m_FileName[MAX_PATH];
+	sEntry m_Entries[BCH_MAX_IMAGES];
+	int    m_Count;
+	bool   m_bChanged;
+};
+
+double bch_Now       (void);
+void   bch_Collect   (const tel_sEvent * pEvent, void * pContext);
+bool   bch_Synthesize(const char * pName, const char * pFileName);
+
+#endif
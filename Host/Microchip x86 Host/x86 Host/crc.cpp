@@ -0,0 +1,39 @@
+/******************************************************************************\
+ *
+ *  crc computes the checksums the bootloader computes on the target, using
+ *  the same nibble-at-a-time tables so both sides are easy to compare.
+ *
+ *  crc_Crc32 is the standard reflected CRC-32 (polynomial 0x04C11DB7, as
+ *  used by zip and Ethernet). crc_Crc32Update continues a CRC over data
+ *  that isn't contiguous, starting from a previous result or 0.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+
+static const unsigned int Crc32Table[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/******************************************************************************/
+unsigned int crc_Crc32(const char * pData, int Size)
+{
+	return crc_Crc32Update(0, pData, Size);
+}
+/******************************************************************************/
+unsigned int crc_Crc32Update(unsigned int Crc, const char * pData, int Size)
+{
+	Crc = ~Crc;
+
+	for(int Count = 0; Count < Size; Count++)
+	{
+		Crc = (Crc >> 4) ^ Crc32Table[(Crc ^ pData[Count]) & 0x0F];
+		Crc = (Crc >> 4) ^ Crc32Table[(Crc ^ (pData[Count] >> 4)) & 0x0F];
+	}
+
+	return ~Crc;
+}
@@ -0,0 +1,7 @@
+#ifndef _crc_h
+#define _crc_h
+
+unsigned int crc_Crc32      (const char * pData, int Size);
+unsigned int crc_Crc32Update(unsigned int Crc, const char * pData, int Size);
+
+#endif
@@ -0,0 +1,369 @@
+/******************************************************************************\
+ *
+ *  dmp reads a range of program memory out of the target into a file, run
+ *  with -d. COMMAND_READ_PM requests go out back to back, up to the window
+ *  ahead of their replies, so a whole flash is read in one session at the
+ *  speed of the link. Framed replies are matched to their request by
+ *  sequence number and a request that isn't answered is sent again, as
+ *  rows are in mem_cMemImage::SendFrames.
+ *
+ *  The file is Intel HEX if its name ends in .hex and raw binary otherwise.
+ *  Both hold four bytes to an instruction, least significant first and a
+ *  zero phantom byte last, so byte addresses are twice program addresses
+ *  as in the hex files that are programmed. Erased records are left out of
+ *  a HEX file; a binary file holds every instruction from the first
+ *  address read.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+typedef struct
+{
+	unsigned int Address;
+	int          Seq;   /* of the request's frame */
+	int          Tries;
+	int          Order; /* in which the request was last sent */
+	bool         bDone;
+	char         Data[PM33F_ROW_SIZE * 3];
+} sRead;
+
+static const char HexDigits[] = "0123456789ABCDEF";
+
+/******************************************************************************/
+dmp_cWriter::dmp_cWriter()
+: m_pFile(NULL),
+  m_bHex(FALSE),
+  m_bFailed(FALSE),
+  m_Upper(0),
+  m_Used(0)
+{
+}
+/******************************************************************************/
+dmp_cWriter::~dmp_cWriter()
+{
+	if(m_pFile != NULL)
+	{
+		fclose(m_pFile);
+	}
+}
+/******************************************************************************/
+bool dmp_cWriter::Open(const char * pFileName)
+{
+	const char * pExtension = strrchr(pFileName, '.');
+
+	if((m_pFile = fopen(pFileName, "wb")) == NULL)
+	{
+		return FALSE;
+	}
+
+	m_bHex = (pExtension != NULL) && (strcmp(pExtension, ".hex") == 0);
+
+	return TRUE;
+}
+/******************************************************************************/
+void dmp_cWriter::Write(unsigned int Address, const char * pRow, int Instructions)
+{
+	/* pRow is a COMMAND_READ_PM reply: three bytes to an instruction, most
+	   significant first. Address needn't start a record; the first record
+	   is cut short so the rest stay aligned */
+	unsigned char Bytes[DMP_RECORD_SIZE];
+	int           Count;
+
+	for(int First = 0; First < Instructions; First += Count)
+	{
+		bool bErased = TRUE;
+
+		Count = min(DMP_RECORD_SIZE / 4 - (int)(((Address / 2) + First) % (DMP_RECORD_SIZE / 4)), Instructions - First);
+
+		for(int Instruction = 0; Instruction < Count; Instruction++)
+		{
+			const char * pInstruction = pRow + (First + Instruction) * 3;
+
+			Bytes[Instruction * 4 + 0] = (unsigned char)pInstruction[2];
+			Bytes[Instruction * 4 + 1] = (unsigned char)pInstruction[1];
+			Bytes[Instruction * 4 + 2] = (unsigned char)pInstruction[0];
+			Bytes[Instruction * 4 + 3] = 0x00;
+
+			if((Bytes[Instruction * 4 + 0] & Bytes[Instruction * 4 + 1] & Bytes[Instruction * 4 + 2]) != 0xFF)
+			{
+				bErased = FALSE;
+			}
+		}
+
+		if(m_bHex != TRUE)
+		{
+			Put((char *)Bytes, Count * 4);
+		}
+		else if(bErased != TRUE)
+		{
+			/* Records are aligned, so none crosses a 64 KB boundary */
+			unsigned int ByteAddress = (Address + First * 2) * 2;
+
+			if((ByteAddress & 0xFFFF0000) != m_Upper)
+			{
+				unsigned char Upper[2];
+
+				m_Upper  = ByteAddress & 0xFFFF0000;
+				Upper[0] = (unsigned char)(m_Upper >> 24);
+				Upper[1] = (unsigned char)(m_Upper >> 16);
+
+				PutRecord(4, 0, Upper, 2);
+			}
+
+			PutRecord(0, ByteAddress & 0xFFFF, Bytes, Count * 4);
+		}
+	}
+}
+/******************************************************************************/
+bool dmp_cWriter::Close(void)
+{
+	bool bClosed;
+
+	if(m_bHex == TRUE)
+	{
+		PutRecord(1, 0, NULL, 0);
+	}
+
+	Flush();
+
+	bClosed = (fclose(m_pFile) == 0) && (m_bFailed != TRUE);
+	m_pFile = NULL;
+
+	return bClosed;
+}
+/******************************************************************************/
+void dmp_cWriter::Put(const char * pData, int Size)
+{
+	while(Size > 0)
+	{
+		int Count = min(Size, DMP_BUFFER_SIZE - m_Used);
+
+		memcpy(m_Buffer + m_Used, pData, Count);
+
+		m_Used += Count;
+		pData  += Count;
+		Size   -= Count;
+
+		if(m_Used == DMP_BUFFER_SIZE)
+		{
+			Flush();
+		}
+	}
+}
+/******************************************************************************/
+void dmp_cWriter::PutRecord(int Type, unsigned int Offset, const unsigned char * pData, int Size)
+{
+	/* One line, formatted without printf: ':', count, offset, type, data
+	   and checksum, two hex digits to a byte */
+	unsigned char Bytes[4 + DMP_RECORD_SIZE + 1];
+	char          Line[1 + (4 + DMP_RECORD_SIZE + 1) * 2 + 2];
+	unsigned char Sum = 0;
+	int           Count;
+
+	Bytes[0] = (unsigned char)Size;
+	Bytes[1] = (unsigned char)(Offset >> 8);
+	Bytes[2] = (unsigned char)(Offset);
+	Bytes[3] = (unsigned char)Type;
+
+	if(Size > 0)
+	{
+		memcpy(Bytes + 4, pData, Size);
+	}
+
+	for(Count = 0; Count < 4 + Size; Count++)
+	{
+		Sum = Sum + Bytes[Count];
+	}
+
+	Bytes[Count++] = (unsigned char)(0x100 - Sum);
+
+	Line[0] = ':';
+
+	for(int Byte = 0; Byte < Count; Byte++)
+	{
+		Line[1 + Byte * 2] = HexDigits[Bytes[Byte] >> 4];
+		Line[2 + Byte * 2] = HexDigits[Bytes[Byte] & 0x0F];
+	}
+
+	Line[1 + Count * 2] = '\r';
+	Line[2 + Count * 2] = '\n';
+
+	Put(Line, 3 + Count * 2);
+}
+/******************************************************************************/
+void dmp_cWriter::Flush(void)
+{
+	if((m_Used > 0) && (fwrite(m_Buffer, 1, m_Used, m_pFile) != (size_t)m_Used))
+	{
+		m_bFailed = TRUE;
+	}
+
+	m_Used = 0;
+}
+/******************************************************************************/
+static void Request(lnk_cLink * pLink, int Caps, sRead * pRead, int Order)
+{
+	char Buffer[4];
+
+	Buffer[0] = COMMAND_READ_PM;
+	Buffer[1] = pRead->Address & 0xFF;
+	Buffer[2] = (pRead->Address >> 8) & 0xFF;
+	Buffer[3] = (pRead->Address >> 16) & 0xFF;
+
+	pRead->Order = Order;
+
+	if(Caps & CAPS_FRAMED)
+	{
+		frm_Send(pLink, pRead->Seq, Buffer, 4);
+	}
+	else
+	{
+		pLink->Write(Buffer, 4);
+	}
+}
+/******************************************************************************/
+bool dmp_Dump(lnk_cLink * pLink, int Caps, int Window, const sDevice * pDevice, unsigned int Start, unsigned int End, dmp_cWriter * pWriter, tel_cSession * pSession)
+{
+	/* Reads program memory from Start up to, not including, End into
+	   pWriter, whole rows at a time, with up to Window requests awaiting a
+	   reply. Reads oldest first; the rows are written out in address order
+	   as the oldest completes, the first and last trimmed to the range.
+	   pReads is a ring: the reads in flight are the InFlight slots from
+	   Oldest on. Each row written out is told to pSession. Returns FALSE if
+	   a row can't be read. */
+	sRead      * pReads;
+	char         Buffer[FRM_MAX_SIZE];
+	int          RowSize  = pDevice->PageSize;
+	int          ReplySize;
+	int          InFlight = 0;
+	int          Oldest   = 0;
+	int          Order    = 0;
+	bool         bFailed  = FALSE;
+	unsigned int Next;
+
+	/* Instructions sit at even addresses: an odd Start keeps the instruction
+	   it falls in, and an odd End the one below it */
+	Start     = Start & ~1;
+	End       = (End + 1) & ~1;
+	ReplySize = RowSize * 3;
+	Next      = Start - Start % (RowSize * 2);
+	Window    = max(1, min(Window, MEM_MAX_WINDOW));
+	pReads    = new sRead[Window];
+
+	while(bFailed != TRUE)
+	{
+		while((InFlight < Window) && (Next < End))
+		{
+			sRead * pRead = &pReads[(Oldest + InFlight++) % Window];
+
+			pRead->Address = Next;
+			pRead->Seq     = frm_NextSeq(pLink);
+			pRead->Tries   = 0;
+			pRead->bDone   = FALSE;
+
+			Request(pLink, Caps, pRead, Order++);
+
+			Next += RowSize * 2;
+		}
+
+		if(InFlight == 0)
+		{
+			break;
+		}
+
+		if((Caps & CAPS_FRAMED) == 0)
+		{
+			/* Plain replies come back in order, unchecked, and one that
+			   doesn't arrive can't be asked for again */
+			if(pLink->Receive(pReads[Oldest].Data, ReplySize, READ_BUFFER_TIMEOUT) != TRUE)
+			{
+				printf("\nNo reply for row at 0x%06x\n", pReads[Oldest].Address);
+				bFailed = TRUE;
+				break;
+			}
+
+			pReads[Oldest].bDone = TRUE;
+		}
+		else
+		{
+			int Size;
+			int Seq;
+			int Resend = Order;
+			int Read;
+
+			Size = frm_Receive(pLink, &Seq, Buffer, lnk_Deadline(frm_Timeout(pLink, InFlight * (8 + ReplySize))));
+
+			if(Size >= 0)
+			{
+				/* A reply to a request no longer awaited is a late duplicate */
+				sRead * pRead = NULL;
+
+				for(Read = 0; (Read < InFlight) && (pRead == NULL); Read++)
+				{
+					sRead * pSlot = &pReads[(Oldest + Read) % Window];
+
+					if((pSlot->Seq == Seq) && (pSlot->bDone != TRUE))
+					{
+						pRead = pSlot;
+					}
+				}
+
+				if(pRead == NULL)
+				{
+					continue;
+				}
+
+				/* Requests sent before the one answered were lost, and a
+				   NACKed request is sent again with them */
+				Resend = pRead->Order;
+
+				if(Size == ReplySize)
+				{
+					memcpy(pRead->Data, Buffer, ReplySize);
+					pRead->bDone = TRUE;
+				}
+				else
+				{
+					Resend++;
+				}
+			}
+
+			for(Read = 0; Read < InFlight; Read++)
+			{
+				sRead * pRead = &pReads[(Oldest + Read) % Window];
+
+				if((pRead->bDone == TRUE) || (pRead->Order >= Resend))
+				{
+					continue;
+				}
+
+				if(++pRead->Tries > FRM_RETRIES)
+				{
+					printf("\nNo reply for row at 0x%06x after %d tries\n", pRead->Address, FRM_RETRIES);
+					bFailed = TRUE;
+					break;
+				}
+
+				Request(pLink, Caps, pRead, Order++);
+			}
+		}
+
+		while((InFlight > 0) && (pReads[Oldest].bDone == TRUE))
+		{
+			sRead      * pRead = &pReads[Oldest];
+			unsigned int First = max(Start, pRead->Address);
+			unsigned int Last  = min(End, pRead->Address + RowSize * 2);
+
+			pWriter->Write(First, pRead->Data + (First - pRead->Address) / 2 * 3, (Last - First) / 2);
+
+			pSession->RowRead(pRead->Address, ((Caps & CAPS_FRAMED) != 0) ? pRead->Seq : -1, pRead->Tries, ReplySize);
+
+			Oldest = (Oldest + 1) % Window;
+			InFlight--;
+		}
+	}
+
+	delete [] pReads;
+
+	return(bFailed != TRUE);
+}
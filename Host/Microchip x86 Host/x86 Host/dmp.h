@@ -0,0 +1,32 @@
+#ifndef _dmp_h
+#define _dmp_h
+
+#define DMP_BUFFER_SIZE (64 * 1024) /* bytes formatted between writes to the file */
+#define DMP_RECORD_SIZE 16          /* data bytes in each Intel HEX record */
+
+class dmp_cWriter
+{
+public:
+	dmp_cWriter();
+	~dmp_cWriter();
+
+	bool Open (const char * pFileName);
+	void Write(unsigned int Address, const char * pRow, int Instructions);
+	bool Close(void);
+
+private:
+	void Put      (const char * pData, int Size);
+	void PutRecord(int Type, unsigned int Offset, const unsigned char * pData, int Size);
+	void Flush    (void);
+
+	FILE         * m_pFile;
+	bool           m_bHex;
+	bool           m_bFailed;
+	unsigned int   m_Upper;   /* address of the last extended linear address record */
+	int            m_Used;
+	char           m_Buffer[DMP_BUFFER_SIZE];
+};
+
+bool dmp_Dump(lnk_cLink * pLink, int Caps, int Window, const sDevice * pDevice, unsigned int Start, unsigned int End, dmp_cWriter * pWriter, tel_cSession * pSession);
+
+#endif
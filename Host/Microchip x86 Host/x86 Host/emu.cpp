@@ -0,0 +1,897 @@
+/******************************************************************************\
+ *
+ *  emu is a model of the x-IMU bootloader in "x-IMU Bootloader/main.c",
+ *  command for command, on an emulated dsPIC33FJ128GP804: flash erases to
+ *  ones a page at a time and rows only clear bits, and the device ID reads
+ *  as the real part's.
+ *
+ *  Time is modelled on one timeline: every byte received or sent costs
+ *  ten bit times at the current UART rate, each page erase and row write
+ *  costs its datasheet latency, and a reply is only handed to the link
+ *  once the timeline has caught up with it. Bytes the host sends while the
+ *  target is busy count from when it is free again, as they would with
+ *  CTS holding the host off.
+ *
+ *  emu_Open runs a target on a thread behind an in-process loopback, for
+ *  -i emu. emu_Serve runs one in the foreground on any link, for -m, so a
+ *  programmer in another process can use it through a pty. Either can be
+ *  given the capabilities to advertise, -i emu:0x00 or -m pty,0x00 for a
+ *  bootloader that predates them and only speaks the plain protocol.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+
+/******************************************************************************/
+emu_cTarget::emu_cTarget(lnk_cLink * pLink)
+: m_pLink(pLink),
+  m_Caps(EMU_CAPS),
+  m_PageEraseUs(EMU_PAGE_ERASE_US),
+  m_RowWriteUs(EMU_ROW_WRITE_US)
+{
+	for(int Word = 0; Word < EMU_PM_SIZE / 2; Word++)
+	{
+		m_Flash[Word] = 0xFFFFFF;
+	}
+
+	for(int Word = 0; Word < EMU_CM_SIZE; Word++)
+	{
+		m_Config[Word] = 0xFFFF;
+	}
+
+	memset(m_Buffer, 0xFF, sizeof(m_Buffer));
+
+	SetDivider(16, EMU_BRGVAL);
+}
+/******************************************************************************/
+void emu_cTarget::Run(void)
+{
+	/* One session, from the first byte until the host resets the target or
+	   falls silent */
+	m_bFramed   = FALSE;
+	m_bUnderrun = FALSE;
+	m_bAckPath  = FALSE;
+	m_bReset    = FALSE;
+	m_RxHead    = 0;
+	m_RxCount   = 0;
+	m_TxCount   = 0;
+	m_BytesIn   = 0;
+	m_BytesOut  = 0;
+	m_Erases    = 0;
+	m_RowWrites = 0;
+	m_Due       = bch_Now();
+
+	m_Pages        = 0;
+	m_PageMaxUs    = 0;
+	m_PageTotalUs  = 0;
+	m_PageErases   = 0;
+	m_EraseMaxUs   = 0;
+	m_EraseTotalUs = 0;
+
+	SetDivider(16, EMU_BRGVAL);
+
+	while(m_bReset == FALSE)
+	{
+		char Command;
+
+		do
+		{
+			Command = GetByte();
+		}
+		while((m_bFramed == TRUE) && ((unsigned char)Command != FRM_SOF) && (m_bReset == FALSE));
+
+		if(((unsigned char)Command == FRM_SOF) && (m_Caps & CAPS_FRAMED))
+		{
+			if(ReceiveFrame() != TRUE)
+			{
+				continue;
+			}
+
+			Command = GetChar();
+		}
+
+		switch(Command)
+		{
+			case COMMAND_READ_PM:
+			{
+				unsigned int Address;
+
+				Address  = (unsigned char)GetChar();
+				Address |= (unsigned char)GetChar() << 8;
+				Address |= (unsigned char)GetChar() << 16;
+
+				ReadPM(m_Buffer, Address);
+
+				for(int Size = 0; Size < PM33F_ROW_SIZE * 3; Size++)
+				{
+					PutChar(m_Buffer[Size]);
+				}
+				break;
+			}
+			case COMMAND_WRITE_PM:
+			case COMMAND_WRITE_PM_RLE:
+			{
+				unsigned int Address;
+				char         Path;
+
+				if((Command == COMMAND_WRITE_PM_RLE) && ((m_Caps & CAPS_WRITE_PM_RLE) == 0))
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				Address  = (unsigned char)GetChar();
+				Address |= (unsigned char)GetChar() << 8;
+				Address |= (unsigned char)GetChar() << 16;
+
+				if(Command == COMMAND_WRITE_PM)
+				{
+					for(int Size = 0; Size < PM33F_ROW_SIZE * 3; Size++)
+					{
+						m_RxBuffer[Size] = GetChar();
+					}
+				}
+				else
+				{
+					ReceiveRLE(m_RxBuffer);
+				}
+
+				if(m_bUnderrun == TRUE)
+				{
+					break;
+				}
+
+				Path = ComparePM(m_RxBuffer, Address);
+
+				if(Path != ACK_UNCHANGED)
+				{
+					int Us = m_RowWriteUs * (PM33F_ROW_SIZE / 64);
+
+					if(Path == COMMAND_ACK)
+					{
+						Erase(Address);
+
+						m_PageErases++;
+						m_EraseMaxUs    = max(m_EraseMaxUs, m_PageEraseUs);
+						m_EraseTotalUs += m_PageEraseUs;
+					}
+
+					WritePM(m_RxBuffer, Address);
+
+					m_Pages++;
+					m_PageMaxUs    = max(m_PageMaxUs, Us);
+					m_PageTotalUs += Us;
+				}
+
+				PutChar((m_bAckPath == TRUE) ? Path : COMMAND_ACK);
+				break;
+			}
+			case COMMAND_ERASE_PM:
+			{
+				unsigned int Address;
+
+				if((m_Caps & CAPS_ERASE_PM) == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				Address  = (unsigned char)GetChar();
+				Address |= (unsigned char)GetChar() << 8;
+				Address |= (unsigned char)GetChar() << 16;
+
+				if(m_bUnderrun == TRUE)
+				{
+					break;
+				}
+
+				if(BlankPM(Address) == TRUE)
+				{
+					PutChar((m_bAckPath == TRUE) ? ACK_UNCHANGED : COMMAND_ACK);
+					break;
+				}
+
+				Erase(Address);
+
+				m_PageErases++;
+				m_EraseMaxUs    = max(m_EraseMaxUs, m_PageEraseUs);
+				m_EraseTotalUs += m_PageEraseUs;
+
+				PutChar(COMMAND_ACK);
+				break;
+			}
+			case COMMAND_READ_CAPS:
+			{
+				if(m_Caps == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				PutCaps();
+				break;
+			}
+			case COMMAND_SET_BAUD:
+			{
+				unsigned int Baud;
+
+				if((m_Caps & CAPS_SET_BAUD) == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				Baud  = (unsigned char)GetChar();
+				Baud |= (unsigned char)GetChar() << 8;
+				Baud |= (unsigned char)GetChar() << 16;
+				Baud |= (unsigned int)(unsigned char)GetChar() << 24;
+
+				if((Baud < 9600) || (m_bFramed == TRUE))
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				PutChar(COMMAND_ACK);
+				SetBaud(Baud);
+				break;
+			}
+			case COMMAND_READ_CRC:
+			{
+				unsigned int Address;
+				int          Rows;
+
+				if((m_Caps & CAPS_READ_CRC) == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				Address  = (unsigned char)GetChar();
+				Address |= (unsigned char)GetChar() << 8;
+				Address |= (unsigned char)GetChar() << 16;
+				Rows     = (unsigned char)GetChar();
+
+				for(; Rows != 0; Rows--)
+				{
+					unsigned int Crc = ReadCRC(Address, PM33F_ROW_SIZE);
+
+					PutChar((char)(Crc));
+					PutChar((char)(Crc >> 8));
+					PutChar((char)(Crc >> 16));
+					PutChar((char)(Crc >> 24));
+
+					Address += PM33F_ROW_SIZE * 2;
+				}
+				break;
+			}
+			case COMMAND_CRC_RANGE:
+			{
+				unsigned int Address;
+				int          Count;
+				unsigned int Crc;
+
+				if((m_Caps & CAPS_CRC_RANGE) == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				Address  = (unsigned char)GetChar();
+				Address |= (unsigned char)GetChar() << 8;
+				Address |= (unsigned char)GetChar() << 16;
+				Count    = (unsigned char)GetChar();
+				Count   |= (unsigned char)GetChar() << 8;
+				Count   |= (unsigned char)GetChar() << 16;
+
+				Crc = ReadCRC(Address, Count);
+
+				PutChar((char)(Crc));
+				PutChar((char)(Crc >> 8));
+				PutChar((char)(Crc >> 16));
+				PutChar((char)(Crc >> 24));
+				break;
+			}
+			case COMMAND_READ_STATS:
+			{
+				if((m_Caps & CAPS_READ_STATS) == 0)
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				PutChar((char)(m_Pages));
+				PutChar((char)(m_Pages >> 8));
+
+				for(int Byte = 0; Byte < 4; Byte++)
+				{
+					PutChar((char)(m_PageMaxUs >> (Byte * 8)));
+				}
+
+				for(int Byte = 0; Byte < 4; Byte++)
+				{
+					PutChar((char)(m_PageTotalUs >> (Byte * 8)));
+				}
+
+				PutChar((char)(m_PageErases));
+				PutChar((char)(m_PageErases >> 8));
+
+				for(int Byte = 0; Byte < 4; Byte++)
+				{
+					PutChar((char)(m_EraseMaxUs >> (Byte * 8)));
+				}
+
+				for(int Byte = 0; Byte < 4; Byte++)
+				{
+					PutChar((char)(m_EraseTotalUs >> (Byte * 8)));
+				}
+				break;
+			}
+			case COMMAND_HELLO:
+			case COMMAND_READ_ID:
+			{
+				/* DEVID and DEVREV of a dsPIC33FJ128GP804 */
+				static const char Id[8] = {0x2F, 0x06, 0x00, 0x00, 0x03, 0x30, 0x00, 0x00};
+
+				if(Command == COMMAND_HELLO)
+				{
+					/* as old a bootloader as COMMAND_READ_CAPS is new to */
+					if(m_Caps == 0)
+					{
+						PutChar(COMMAND_NACK);
+						break;
+					}
+
+					if((m_bFramed == TRUE) && (m_FrameSize > 1))
+					{
+						m_bAckPath = (GetChar() & HELLO_ACK_PATH) != 0;
+					}
+
+					PutCaps();
+				}
+
+				for(int Size = 0; Size < (int)sizeof(Id); Size++)
+				{
+					PutChar(Id[Size]);
+				}
+				break;
+			}
+			case COMMAND_WRITE_CM:
+			{
+				/* held in the row buffer until COMMAND_RESET, as on the target;
+				   a short frame leaves the last whole one's words */
+				if((m_bFramed == TRUE) && (m_FrameSize < 1 + EMU_CM_SIZE * 3))
+				{
+					PutChar(COMMAND_NACK);
+					break;
+				}
+
+				for(int Size = 0; Size < EMU_CM_SIZE * 3;)
+				{
+					m_Buffer[Size++] = GetChar();
+					m_Buffer[Size++] = GetChar();
+					m_Buffer[Size++] = GetChar();
+
+					PutChar(COMMAND_ACK);
+				}
+				break;
+			}
+			case COMMAND_RESET:
+			{
+				WriteConfig();
+				m_bReset = TRUE;
+				break;
+			}
+			case COMMAND_NACK:
+			{
+				m_bReset = TRUE;
+				break;
+			}
+			default:
+			{
+				PutChar(COMMAND_NACK);
+				break;
+			}
+		}
+
+		if(m_bReset == TRUE)
+		{
+			break;
+		}
+
+		if(m_bUnderrun == TRUE)
+		{
+			/* nothing was done, the host resends */
+			m_ReplySize = 0;
+			PutChar(COMMAND_NACK);
+		}
+
+		if(m_bFramed == TRUE)
+		{
+			SendFrame();
+		}
+
+		Flush();
+	}
+
+	Flush();
+}
+/******************************************************************************/
+bool emu_cTarget::Fill(int Timeout)
+{
+	if(m_RxCount == 0)
+	{
+		/* anything owed to the host goes out before waiting on it */
+		Flush();
+
+		m_RxHead  = 0;
+		m_RxCount = m_pLink->Read(m_Rx, sizeof(m_Rx), lnk_Deadline(Timeout));
+	}
+
+	return(m_RxCount > 0);
+}
+/******************************************************************************/
+char emu_cTarget::GetByteTimeout(int Timeout)
+{
+	if(Fill(Timeout) != TRUE)
+	{
+		return COMMAND_NACK;
+	}
+
+	m_RxCount--;
+	m_BytesIn++;
+
+	m_Due = max(m_Due, bch_Now()) + m_ByteUs;
+
+	return m_Rx[m_RxHead++];
+}
+/******************************************************************************/
+char emu_cTarget::GetByte(void)
+{
+	/* The target waits for ever once it has heard from the host; here a
+	   long silence ends the session as if the host had reset it */
+	if((m_bReset == TRUE) || (Fill(EMU_IDLE_TIMEOUT) != TRUE))
+	{
+		m_bReset = TRUE;
+		return COMMAND_NACK;
+	}
+
+	return GetByteTimeout(EMU_IDLE_TIMEOUT);
+}
+/******************************************************************************/
+char emu_cTarget::GetChar(void)
+{
+	if(m_bFramed == TRUE)
+	{
+		/* never past the payload: the command is NACKed instead */
+		if(m_FrameIndex >= m_FrameSize)
+		{
+			m_bUnderrun = TRUE;
+			return 0;
+		}
+
+		return m_Frame[m_FrameIndex++];
+	}
+
+	return GetByte();
+}
+/******************************************************************************/
+void emu_cTarget::PutByte(char Byte)
+{
+	if(m_TxCount == sizeof(m_Tx))
+	{
+		Flush();
+	}
+
+	m_Tx[m_TxCount++] = Byte;
+	m_BytesOut++;
+
+	m_Due += m_ByteUs;
+}
+/******************************************************************************/
+void emu_cTarget::PutChar(char Char)
+{
+	if(m_bFramed == TRUE)
+	{
+		m_Frame[m_ReplySize++] = Char;
+		return;
+	}
+
+	PutByte(Char);
+}
+/******************************************************************************/
+void emu_cTarget::PutCaps(void)
+{
+	PutChar(COMMAND_ACK);
+	PutChar(EMU_VERSION);
+	PutChar((char)m_Caps);
+}
+/******************************************************************************/
+bool emu_cTarget::ReceiveFrame(void)
+{
+	int  Size;
+	char Header[3];
+	char Crc[4];
+
+	m_bFramed    = TRUE;
+	m_bUnderrun  = FALSE;
+	m_FrameIndex = 0;
+	m_ReplySize  = 0;
+
+	m_FrameSeq = Header[0] = GetByte();
+	Header[1]  = GetByte();
+	Header[2]  = GetByte();
+
+	Size = (unsigned char)Header[1] | ((unsigned char)Header[2] << 8);
+
+	if(Size > EMU_FRAME_SIZE)
+	{
+		return FALSE;
+	}
+
+	m_FrameSize = Size;
+
+	for(int Index = 0; Index < Size; Index++)
+	{
+		m_Frame[Index] = GetByte();
+	}
+
+	for(int Index = 0; Index < 4; Index++)
+	{
+		Crc[Index] = GetByte();
+	}
+
+	unsigned int Check = crc_Crc32Update(crc_Crc32(Header, 3), m_Frame, Size);
+
+	/* an empty frame has no command */
+	if((((unsigned char)Crc[0] | ((unsigned char)Crc[1] << 8) | ((unsigned char)Crc[2] << 16) | ((unsigned int)(unsigned char)Crc[3] << 24)) != Check) || (Size == 0))
+	{
+		PutChar(COMMAND_NACK);
+		SendFrame();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+void emu_cTarget::SendFrame(void)
+{
+	char         Header[4];
+	unsigned int Crc;
+
+	Header[0] = (char)FRM_SOF;
+	Header[1] = m_FrameSeq;
+	Header[2] = (char)(m_ReplySize);
+	Header[3] = (char)(m_ReplySize >> 8);
+
+	Crc = crc_Crc32Update(crc_Crc32(Header + 1, 3), m_Frame, m_ReplySize);
+
+	for(int Index = 0; Index < 4; Index++)
+	{
+		PutByte(Header[Index]);
+	}
+
+	for(int Index = 0; Index < m_ReplySize; Index++)
+	{
+		PutByte(m_Frame[Index]);
+	}
+
+	PutByte((char)(Crc));
+	PutByte((char)(Crc >> 8));
+	PutByte((char)(Crc >> 16));
+	PutByte((char)(Crc >> 24));
+}
+/******************************************************************************/
+void emu_cTarget::ReceiveRLE(char * pRow)
+{
+	/* 0nnnnnnn: n+1 words of 2 bytes, upper byte 0
+	   10nnnnnn: n+1 words of 3 bytes
+	   11nnnnnn: 1 word of 3 bytes, n+1 times */
+	for(int Size = 0; Size < PM33F_ROW_SIZE * 3;)
+	{
+		char Control = GetChar();
+		int  Count   = (Control & 0x80) ? (Control & 0x3F) + 1 : Control + 1;
+		bool bRepeat = FALSE;
+
+		for(; (Count != 0) && (Size < PM33F_ROW_SIZE * 3); Count--)
+		{
+			if(bRepeat == TRUE)
+			{
+				memcpy(pRow + Size, pRow + Size - 3, 3);
+			}
+			else
+			{
+				pRow[Size]     = GetChar();
+				pRow[Size + 1] = GetChar();
+				pRow[Size + 2] = (Control & 0x80) ? GetChar() : 0;
+
+				bRepeat = ((Control & 0xC0) == 0xC0);
+			}
+
+			Size += 3;
+		}
+	}
+}
+/******************************************************************************/
+void emu_cTarget::ReadPM(char * pData, unsigned int Address)
+{
+	/* most significant byte first, the reverse of what WritePM takes */
+	for(int Size = 0; Size < PM33F_ROW_SIZE; Size++, Address += 2)
+	{
+		unsigned int Word = this->Word(Address);
+
+		pData[0] = (char)(Word >> 16);
+		pData[1] = (char)(Word >> 8);
+		pData[2] = (char)(Word);
+
+		pData += 3;
+	}
+}
+/******************************************************************************/
+void emu_cTarget::WritePM(const char * pData, unsigned int Address)
+{
+	for(int Size = 0; Size < PM33F_ROW_SIZE; Size++, Address += 2)
+	{
+		unsigned int Word = (unsigned char)pData[0] | ((unsigned char)pData[1] << 8) | ((unsigned char)pData[2] << 16);
+
+		if(Address < EMU_PM_SIZE)
+		{
+			m_Flash[Address / 2] &= Word;
+		}
+
+		pData += 3;
+	}
+
+	m_RowWrites += PM33F_ROW_SIZE / 64;
+	m_Due       += (double)m_RowWriteUs * (PM33F_ROW_SIZE / 64);
+}
+/******************************************************************************/
+void emu_cTarget::Erase(unsigned int Address)
+{
+	Address &= ~(PM33F_ROW_SIZE * 2 - 1);
+
+	for(int Word = 0; (Word < PM33F_ROW_SIZE) && (Address < EMU_PM_SIZE); Word++, Address += 2)
+	{
+		m_Flash[Address / 2] = 0xFFFFFF;
+	}
+
+	m_Erases++;
+	m_Due += m_PageEraseUs;
+}
+/******************************************************************************/
+char emu_cTarget::ComparePM(const char * pData, unsigned int Address)
+{
+	/* The write a page needs, as the target decides it before touching flash */
+	Address &= ~(PM33F_ROW_SIZE * 2 - 1);
+
+	for(int Size = 0; Size < PM33F_ROW_SIZE; Size++, pData += 3)
+	{
+		unsigned int Word = (unsigned char)pData[0] | ((unsigned char)pData[1] << 8) | ((unsigned char)pData[2] << 16);
+
+		if(this->Word(Address + Size * 2) != Word)
+		{
+			return((BlankPM(Address) == TRUE) ? ACK_NO_ERASE : COMMAND_ACK);
+		}
+	}
+
+	return ACK_UNCHANGED;
+}
+/******************************************************************************/
+bool emu_cTarget::BlankPM(unsigned int Address)
+{
+	Address &= ~(PM33F_ROW_SIZE * 2 - 1);
+
+	for(int Size = 0; Size < PM33F_ROW_SIZE; Size++)
+	{
+		if(Word(Address + Size * 2) != 0xFFFFFF)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+unsigned int emu_cTarget::ReadCRC(unsigned int Address, int Count)
+{
+	/* over the bytes of Count instructions in the order WritePM takes them */
+	unsigned int Crc = 0;
+
+	for(; Count != 0; Count--, Address += 2)
+	{
+		unsigned int Word = this->Word(Address);
+		char         Bytes[3];
+
+		Bytes[0] = (char)(Word);
+		Bytes[1] = (char)(Word >> 8);
+		Bytes[2] = (char)(Word >> 16);
+
+		Crc = crc_Crc32Update(Crc, Bytes, 3);
+	}
+
+	return Crc;
+}
+/******************************************************************************/
+void emu_cTarget::WriteConfig(void)
+{
+	/* a word is only written if the host didn't mark it empty */
+	for(int Word = 0; Word < EMU_CM_SIZE; Word++)
+	{
+		if(m_Buffer[Word * 3] == 0)
+		{
+			m_Config[Word] = (unsigned char)m_Buffer[Word * 3 + 1] | ((unsigned char)m_Buffer[Word * 3 + 2] << 8);
+		}
+	}
+}
+/******************************************************************************/
+void emu_cTarget::SetBaud(unsigned int Baud)
+{
+	/* the acknowledgement goes at the old rate, then the host has to prove
+	   both directions work at the new one or the target reverts */
+	Flush();
+
+	SetDivider(4, (int)((EMU_FCY + 2 * (double)Baud) / (4 * (double)Baud)) - 1);
+
+	if(GetByteTimeout(420) == COMMAND_READ_CAPS)
+	{
+		PutCaps();
+
+		if(GetByteTimeout(420) == COMMAND_ACK)
+		{
+			return;
+		}
+	}
+
+	Flush();
+
+	SetDivider(16, EMU_BRGVAL);
+}
+/******************************************************************************/
+void emu_cTarget::SetDivider(int Divider, int Brg)
+{
+	m_BaudRate = EMU_FCY / (Divider * (Brg + 1));
+	m_ByteUs   = 10000000.0 / m_BaudRate;
+}
+/******************************************************************************/
+void emu_cTarget::Flush(void)
+{
+	double Wait = m_Due - bch_Now();
+
+	if(Wait >= 1000.0)
+	{
+		Sleep((DWORD)(Wait / 1000.0));
+	}
+
+	if(m_TxCount > 0)
+	{
+		m_pLink->Write(m_Tx, m_TxCount);
+		m_TxCount = 0;
+	}
+}
+/******************************************************************************/
+#ifdef _WIN32
+static unsigned __stdcall ServeThread(void * pParam)
+#else
+static void * ServeThread(void * pParam)
+#endif
+{
+	emu_cTarget * pTarget = (emu_cTarget *)pParam;
+
+	pTarget->Run();
+
+	return 0;
+}
+/******************************************************************************/
+void emu_cTarget::Start(void)
+{
+	/* Runs one session on a thread of its own */
+#ifdef _WIN32
+	m_Thread = (HANDLE)_beginthreadex(NULL, 0, ServeThread, this, 0, NULL);
+	assert(m_Thread != 0);
+#else
+	int Result = pthread_create(&m_Thread, NULL, ServeThread, this);
+	assert(Result == 0);
+#endif
+}
+/******************************************************************************/
+void emu_cTarget::Join(void)
+{
+#ifdef _WIN32
+	WaitForSingleObject(m_Thread, INFINITE);
+	CloseHandle(m_Thread);
+#else
+	pthread_join(m_Thread, NULL);
+#endif
+}
+/******************************************************************************/
+int emu_cTarget::Compare(mem_cMemImage * pImage)
+{
+	/* Counts the program words that differ from a formatted image, leaving
+	   out the reset vector, which the programmer keeps the bootloader's */
+	int Errors = 0;
+
+	for(int Row = 0; Row < pImage->ProgramRows(); Row++)
+	{
+		mem_cMemRow         * pRow = pImage->Row(Row);
+		const unsigned char * pData;
+
+		if((pRow == NULL) || (pRow->IsEmpty() == TRUE))
+		{
+			continue;
+		}
+
+		pData = (const unsigned char *)pRow->Buffer();
+
+		for(int Word = 0; Word < pRow->Size() / 3; Word++, pData += 3)
+		{
+			unsigned int Address = pRow->Address() + Word * 2;
+
+			if((Address < 4) || (Address >= EMU_PM_SIZE))
+			{
+				continue;
+			}
+
+			if(m_Flash[Address / 2] != (unsigned int)(pData[0] | (pData[1] << 8) | (pData[2] << 16)))
+			{
+				Errors++;
+			}
+		}
+	}
+
+	return Errors;
+}
+/******************************************************************************/
+lnk_cLink * emu_Open(int Caps)
+{
+	/* The target and its end of the loopback live as long as the process,
+	   the session ends with the programmer's COMMAND_RESET */
+	lnk_cLoopback * pHost   = new lnk_cLoopback();
+	emu_cTarget   * pTarget = new emu_cTarget(new lnk_cLoopback(pHost));
+
+	pTarget->SetCaps(Caps);
+
+	pHost->SetBaudRate(pTarget->BaudRate());
+
+	pTarget->Start();
+
+	return pHost;
+}
+/******************************************************************************/
+void emu_Serve(char * pName)
+{
+	/* pName is interface[,caps], caps in hex */
+	char        * pCaps = strchr(pName, ',');
+	lnk_cLink   * pLink;
+	emu_cTarget * pTarget;
+
+	if(pCaps != NULL)
+	{
+		*pCaps++ = '\0';
+	}
+
+	if((pLink = lnk_Open(pName, "115200")) == NULL)
+	{
+		printf("\nCan't open %s\n", pName);
+		return;
+	}
+
+	pTarget = new emu_cTarget(pLink);
+
+	if(pCaps != NULL)
+	{
+		pTarget->SetCaps((int)strtol(pCaps, NULL, 16));
+	}
+
+	printf("\nEmulating the x-IMU bootloader on %s\n", pName);
+
+	for(;;)
+	{
+		pTarget->Run();
+
+		if(pTarget->BytesIn() > 0)
+		{
+			printf("\nSession: %d bytes in, %d out, %d page erases, %d row writes, %d baud\n",
+			       pTarget->BytesIn(), pTarget->BytesOut(), pTarget->Erases(), pTarget->RowWrites(), pTarget->BaudRate());
+		}
+	}
+}
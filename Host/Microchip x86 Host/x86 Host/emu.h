@@ -0,0 +1,108 @@
+#ifndef _emu_h
+#define _emu_h
+
+#define EMU_FCY           39998371
+#define EMU_BRGVAL        21
+#define EMU_PM_SIZE       0x15800             /* program memory of a dsPIC33FJ128GP804, in addresses */
+#define EMU_CM_SIZE       8                   /* configuration words, as CM_ROW_SIZE in main.c */
+#define EMU_VERSION       0x18                /* bootloader version, as BOOTLOADER_VERSION in main.c */
+#define EMU_CAPS          (CAPS_ERASE_PM | CAPS_READ_CRC | CAPS_FLOW_CONTROL | CAPS_SET_BAUD | CAPS_WRITE_PM_RLE | CAPS_FRAMED | CAPS_CRC_RANGE | CAPS_READ_STATS)
+#define EMU_PAGE_ERASE_US 20000               /* TPE from the datasheet */
+#define EMU_ROW_WRITE_US  1600                /* TRW, eight rows to a page */
+#define EMU_IDLE_TIMEOUT  10000               /* ms of silence taken as the end of a session */
+#define EMU_FRAME_SIZE    (4 + PM33F_ROW_SIZE * 3)
+#define EMU_TX_SIZE       4096
+
+class emu_cTarget
+{
+public:
+	emu_cTarget(lnk_cLink * pLink);
+
+	void Run  (void);
+	void Start(void);
+	void Join (void);
+	int  Compare(mem_cMemImage * pImage);
+
+	void SetCaps   (int Caps)                        { m_Caps = Caps; }
+
+	unsigned int Word     (unsigned int Address) { return m_Flash[(Address % EMU_PM_SIZE) / 2]; }
+	int          BaudRate (void)                 { return m_BaudRate; }
+	int          BytesIn  (void)                 { return m_BytesIn; }
+	int          BytesOut (void)                 { return m_BytesOut; }
+	int          Erases   (void)                 { return m_Erases; }
+	int          RowWrites(void)                 { return m_RowWrites; }
+
+private:
+	bool         Fill          (int Timeout);
+	char         GetByte       (void);
+	char         GetByteTimeout(int Timeout);
+	char         GetChar       (void);
+	void         PutByte       (char Byte);
+	void         PutChar       (char Char);
+	void         PutCaps       (void);
+	bool         ReceiveFrame  (void);
+	void         SendFrame     (void);
+	void         ReceiveRLE    (char * pRow);
+	void         ReadPM        (char * pData, unsigned int Address);
+	void         WritePM       (const char * pData, unsigned int Address);
+	void         Erase         (unsigned int Address);
+	char         ComparePM     (const char * pData, unsigned int Address);
+	bool         BlankPM       (unsigned int Address);
+	unsigned int ReadCRC       (unsigned int Address, int Count);
+	void         WriteConfig   (void);
+	void         SetBaud       (unsigned int Baud);
+	void         SetDivider    (int Divider, int Brg);
+	void         Flush         (void);
+
+	lnk_cLink    * m_pLink;
+	int            m_Caps;
+	int            m_PageEraseUs;
+	int            m_RowWriteUs;
+
+	unsigned int   m_Flash[EMU_PM_SIZE / 2];
+	unsigned short m_Config[EMU_CM_SIZE];
+	char           m_Buffer[PM33F_ROW_SIZE * 3 + 1];
+	char           m_RxBuffer[PM33F_ROW_SIZE * 3];
+
+	char           m_Frame[EMU_FRAME_SIZE];
+	int            m_FrameIndex;
+	int            m_ReplySize;
+	int            m_FrameSize;
+	char           m_FrameSeq;
+	bool           m_bFramed;
+	bool           m_bUnderrun;   /* the command read past the end of its frame */
+	bool           m_bAckPath;    /* set by HELLO_ACK_PATH */
+	bool           m_bReset;
+
+	char           m_Rx[256];
+	int            m_RxHead;
+	int            m_RxCount;
+	char           m_Tx[EMU_TX_SIZE];
+	int            m_TxCount;
+
+	int            m_BaudRate;
+	double         m_ByteUs;
+	double         m_Due;
+
+	int            m_BytesIn;
+	int            m_BytesOut;
+	int            m_Erases;
+	int            m_RowWrites;
+	int            m_Pages;       /* written, as COMMAND_READ_STATS reports */
+	int            m_PageMaxUs;
+	int            m_PageTotalUs;
+	int            m_PageErases;  /* erased, before programming or left blank */
+	int            m_EraseMaxUs;
+	int            m_EraseTotalUs;
+
+#ifdef _WIN32
+	HANDLE         m_Thread;
+#else
+	pthread_t      m_Thread;
+#endif
+};
+
+lnk_cLink * emu_Open (int Caps);
+void        emu_Serve(char * pName);
+
+#endif
@@ -0,0 +1,186 @@
+/******************************************************************************\
+ *
+ *  frm is protocol v2, used with bootloaders that advertise CAPS_FRAMED.
+ *  Every command and every reply travels in a frame:
+ *
+ *    sof      u8    FRM_SOF
+ *    seq      u8    sequence number, echoed in the reply
+ *    length   u16   payload size, little-endian
+ *    payload        command and arguments, or the reply bytes
+ *    crc      u32   CRC-32 of seq, length and payload, little-endian
+ *
+ *  Once the bootloader has seen a frame it ignores anything between frames.
+ *  It answers a damaged frame with a NACK carrying the sequence number it
+ *  read, and drops frames whose header doesn't make sense, so a request is
+ *  resent after a NACK or a timeout. Resending is safe because the commands
+ *  are idempotent, with two exceptions. COMMAND_WRITE_CM changes the
+ *  configuration words the bootloader holds until the reset, so a late
+ *  duplicate could replace newer ones. COMMAND_RESET restarts the target,
+ *  so a resend reaches the application rather than the bootloader. A
+ *  session sends each of them once, last. A frame too short for its
+ *  command is NACKed and the command isn't run.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+/******************************************************************************/
+int frm_NextSeq(lnk_cLink *pLink)
+{
+	return pLink->NextSeq();
+}
+/******************************************************************************/
+int frm_Timeout(lnk_cLink *pLink, int Bytes)
+{
+	/* Time to wait for a reply with Bytes still to cross the link */
+	int BaudRate = pLink->BaudRate();
+
+	if(BaudRate == 0)
+	{
+		return(FRM_TIMEOUT + Bytes);
+	}
+
+	return(FRM_TIMEOUT + (int)(Bytes * 10000.0 / BaudRate));
+}
+/******************************************************************************/
+void frm_Send(lnk_cLink *pLink, int Seq, const char * pPayload, int Size)
+{
+	char         Header[4];
+	char         Trailer[4];
+	unsigned int Crc;
+
+	assert(Size <= FRM_MAX_SIZE);
+
+	Header[0] = (char)FRM_SOF;
+	Header[1] = (char)Seq;
+	Header[2] = (Size)      & 0xFF;
+	Header[3] = (Size >> 8) & 0xFF;
+
+	Crc = crc_Crc32(Header + 1, 3);
+	Crc = crc_Crc32Update(Crc, pPayload, Size);
+
+	Trailer[0] = (Crc)       & 0xFF;
+	Trailer[1] = (Crc >> 8)  & 0xFF;
+	Trailer[2] = (Crc >> 16) & 0xFF;
+	Trailer[3] = (Crc >> 24) & 0xFF;
+
+	lnk_sBuffer Buffers[3] =
+	{
+		{Header,   4},
+		{pPayload, Size},
+		{Trailer,  4}
+	};
+
+	pLink->Write(Buffers, 3);
+}
+/******************************************************************************/
+int frm_Receive(lnk_cLink *pLink, int * pSeq, char * pPayload, DWORD Deadline)
+{
+	/* Returns the payload size of the next frame, or -1 if none arrived
+	   before Deadline or it was damaged */
+	unsigned char Buffer[8 + FRM_MAX_SIZE];
+	unsigned int  Crc;
+	int           Size;
+
+	do
+	{
+		if(pLink->ReceiveUntil((char *)Buffer, 1, Deadline) != TRUE)
+		{
+			return(-1);
+		}
+	}
+	while(Buffer[0] != FRM_SOF);
+
+	if(pLink->ReceiveUntil((char *)Buffer + 1, 3, Deadline) != TRUE)
+	{
+		return(-1);
+	}
+
+	Size = Buffer[2] | (Buffer[3] << 8);
+
+	if((Size > FRM_MAX_SIZE) ||
+	   (pLink->ReceiveUntil((char *)Buffer + 4, Size + 4, Deadline) != TRUE))
+	{
+		return(-1);
+	}
+
+	Crc = Buffer[4 + Size] | (Buffer[5 + Size] << 8) | (Buffer[6 + Size] << 16) | ((unsigned int)Buffer[7 + Size] << 24);
+
+	if(crc_Crc32((char *)Buffer + 1, 3 + Size) != Crc)
+	{
+		return(-1);
+	}
+
+	*pSeq = Buffer[1];
+
+	memcpy(pPayload, Buffer + 4, Size);
+
+	return(Size);
+}
+/******************************************************************************/
+bool frm_Request(lnk_cLink *pLink, int Caps, const char * pRequest, int RequestSize, char * pReply, int ReplySize)
+{
+	/* Sends a request and waits for its reply. Without CAPS_FRAMED this is
+	   the plain command exchange, which fails if the reply doesn't arrive
+	   within READ_BUFFER_TIMEOUT and is never resent. A framed request is resent until a reply
+	   of ReplySize bytes comes back with its sequence number, at most
+	   FRM_RETRIES times. A ReplySize of 0 is for commands that aren't
+	   answered, such as COMMAND_RESET, which are only resent if NACKed.
+	   Resends assume the command is idempotent; COMMAND_WRITE_CM and
+	   COMMAND_RESET are not, see above. */
+	char Buffer[FRM_MAX_SIZE];
+	int  Seq = frm_NextSeq(pLink);
+
+	if((Caps & CAPS_FRAMED) == 0)
+	{
+		pLink->Write(pRequest, RequestSize);
+
+		if(pLink->Receive(pReply, ReplySize, READ_BUFFER_TIMEOUT) != TRUE)
+		{
+			printf("\nNo reply from target\n");
+			return(FALSE);
+		}
+
+		return(TRUE);
+	}
+
+	for(int Try = 0; Try < FRM_RETRIES; Try++)
+	{
+		DWORD Deadline = lnk_Deadline(frm_Timeout(pLink, RequestSize + ReplySize));
+		int   ReplySeq;
+		int   Size;
+
+		frm_Send(pLink, Seq, pRequest, RequestSize);
+
+		/* Skip late replies to requests that were given up on */
+		do
+		{
+			Size = frm_Receive(pLink, &ReplySeq, Buffer, Deadline);
+		}
+		while((Size >= 0) && (ReplySeq != Seq));
+
+		if(Size < 0)
+		{
+			if(ReplySize == 0)
+			{
+				return(TRUE);
+			}
+
+			continue;
+		}
+
+		if((Size == 1) && (Buffer[0] == COMMAND_NACK))
+		{
+			continue;
+		}
+
+		if(Size == ReplySize)
+		{
+			memcpy(pReply, Buffer, Size);
+			return(TRUE);
+		}
+	}
+
+	printf("\nNo reply from target after %d tries\n", FRM_RETRIES);
+
+	return(FALSE);
+}
@@ -0,0 +1,15 @@
+#ifndef _frm_h
+#define _frm_h
+
+#define FRM_SOF      0xA5
+#define FRM_MAX_SIZE (4 + PM33F_ROW_SIZE * 3) /* payload of a raw COMMAND_WRITE_PM */
+#define FRM_TIMEOUT  250                      /* ms, on top of the time on the wire */
+#define FRM_RETRIES  8
+
+int  frm_NextSeq(lnk_cLink *pLink);
+int  frm_Timeout(lnk_cLink *pLink, int Bytes);
+void frm_Send   (lnk_cLink *pLink, int Seq, const char * pPayload, int Size);
+int  frm_Receive(lnk_cLink *pLink, int * pSeq, char * pPayload, DWORD Deadline);
+bool frm_Request(lnk_cLink *pLink, int Caps, const char * pRequest, int RequestSize, char * pReply, int ReplySize);
+
+#endif
@@ -0,0 +1,698 @@
+/******************************************************************************\
+ *
+ *  hex decodes a whole Intel HEX record in a single pass.  Every character
+ *  pair is converted through a 256 entry nibble table, the record checksum is
+ *  accumulated on the way through and the data bytes are returned both as
+ *  bytes and as the big-endian 16-bit words that mem_cMemRow stores, so a
+ *  record can be handed to a row in bulk.
+ *
+ *  Characters that are not hex digits map to 0xFF, so OR-ing the nibbles of
+ *  a record together and testing the high bits detects any bad character
+ *  without a branch per digit.
+ *
+ *  hex_LoadFile memory-maps a whole file, cuts it into chunks on record
+ *  boundaries and decodes the chunks on a pool of threads.  A first pass
+ *  finds the last extended address (type 04) record of every chunk so each
+ *  chunk knows the extended address it starts with and can then be decoded
+ *  independently of the others.
+ *
+ *  The first pass also notes where each chunk's data starts and ends. When
+ *  the records of the file are in ascending address order, as compilers
+ *  write them, nothing below the start of the first chunk still being
+ *  decoded can change any more, and that much of the image is published
+ *  for sending while the rest is decoded.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+
+static const unsigned char Nibble[256] =
+{
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+typedef struct
+{
+	const char * pStart;
+	const char * pEnd;
+	int          LastExtAddr;   /* last type 04 record in chunk, -1 if none */
+	int          ExtAddr;       /* extended address at start of chunk */
+	int          First;         /* address of the first data record, -1 if none */
+	int          Last;          /* and of the last */
+	bool         bFirstLocal;   /* before the chunk's first type 04, so */
+	bool         bLastLocal;    /* still to be offset by ExtAddr */
+	int          LocalLast;     /* last data before the first type 04 and */
+	int          FarFirst;      /* first data after it, -1 if not both */
+	bool         bOrdered;      /* data records in ascending address order */
+	bool         bDecoded;
+	const char * pError;
+	const char * pMessage;
+} sChunk;
+
+typedef struct
+{
+	sChunk           * pChunks;
+	int                ChunkCount;
+	volatile LONG      NextChunk;
+	bool               bDecode;
+	mem_cMemImage    * pMemory;
+
+	CRITICAL_SECTION   Lock;       /* guards the rest */
+	int                Decoded;    /* chunks decoded in a row from the first */
+	bool               bOrdered;   /* the whole file, so rows can be published */
+} sLoad;
+
+static void ScanChunk  (sChunk * pChunk);
+static void DecodeChunk(sChunk * pChunk, mem_cMemImage * pMemory);
+
+/******************************************************************************/
+hex_cRecord::hex_cRecord()
+: m_ByteCount(0),
+  m_Address(0),
+  m_RecordType(0)
+{ }
+/******************************************************************************/
+bool hex_cRecord::Decode(const char * pLine, int Length)
+{
+	const unsigned char * pChar = (const unsigned char *)pLine + 1;
+	unsigned char         Bad;
+	unsigned char         Sum;
+	int                   Size;
+
+	if((Length < 11) || (pLine[0] != ':'))
+	{
+		return FALSE;
+	}
+
+	Bad  = Nibble[pChar[0]] | Nibble[pChar[1]];
+	Size = (Nibble[pChar[0]] << 4) | Nibble[pChar[1]];
+
+	if((Bad & 0xF0) || (Length < 11 + Size * 2))
+	{
+		return FALSE;
+	}
+
+	/* count, address, type, data and checksum */
+	Size = Size + 5;
+	Sum  = 0;
+
+	for(int Count = 0; Count < Size; Count++, pChar += 2)
+	{
+		unsigned char High = Nibble[pChar[0]];
+		unsigned char Low  = Nibble[pChar[1]];
+
+		Bad             |= High | Low;
+		m_Bytes[Count]   = (High << 4) | Low;
+		Sum             += m_Bytes[Count];
+	}
+
+	if((Bad & 0xF0) || (Sum != 0))
+	{
+		return FALSE;
+	}
+
+	m_ByteCount  = m_Bytes[0];
+	m_Address    = (m_Bytes[1] << 8) | m_Bytes[2];
+	m_RecordType = m_Bytes[3];
+
+	/* an odd trailing byte is padded with unprogrammed 0xFF */
+	m_Bytes[4 + m_ByteCount] = 0xFF;
+
+	for(int Count = 0; Count < WordCount(); Count++)
+	{
+		m_Words[Count] = (m_Bytes[4 + Count * 2] << 8) | m_Bytes[5 + Count * 2];
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+static const char * NextLine(const char * pChar, const char * pEnd)
+{
+	const char * pLine = (const char *)memchr(pChar, '\n', pEnd - pChar);
+
+	return (pLine == NULL) ? pEnd : pLine + 1;
+}
+/******************************************************************************/
+static void ScanChunk(sChunk * pChunk)
+{
+	/* Until the chunk's first type 04 record its extended address isn't
+	   known, so addresses are kept local to it and offset later */
+	int ExtAddr = 0;
+
+	pChunk->LastExtAddr = -1;
+	pChunk->First       = -1;
+	pChunk->Last        = -1;
+	pChunk->LocalLast   = -1;
+	pChunk->FarFirst    = -1;
+	pChunk->bOrdered    = TRUE;
+
+	for(const char * pLine = pChunk->pStart; pLine < pChunk->pEnd; pLine = NextLine(pLine, pChunk->pEnd))
+	{
+		/* only type 04 and data records matter here, spot them by their
+		   type field; data records need no more than their address */
+		if((pChunk->pEnd - pLine < 9) || (pLine[0] != ':') || (pLine[7] != '0'))
+		{
+			continue;
+		}
+
+		if(pLine[8] == '4')
+		{
+			hex_cRecord Record;
+
+			if(Record.Decode(pLine, (int)(NextLine(pLine, pChunk->pEnd) - pLine)) && (Record.RecordType() == 4))
+			{
+				pChunk->LastExtAddr = ((Record.Data()[0] << 8) | Record.Data()[1]) << 16;
+				ExtAddr             = pChunk->LastExtAddr;
+			}
+		}
+		else if(pLine[8] == '0')
+		{
+			const unsigned char * pChar   = (const unsigned char *)pLine + 3;
+			int                   Address = ExtAddr + ((Nibble[pChar[0]] << 12) | (Nibble[pChar[1]] << 8) | (Nibble[pChar[2]] << 4) | Nibble[pChar[3]]);
+			bool                  bLocal  = (pChunk->LastExtAddr == -1);
+
+			if(pChunk->First == -1)
+			{
+				pChunk->First       = Address;
+				pChunk->bFirstLocal = bLocal;
+			}
+			else if(pChunk->bLastLocal != bLocal)
+			{
+				pChunk->LocalLast = pChunk->Last;
+				pChunk->FarFirst  = Address;
+			}
+			else if(Address < pChunk->Last)
+			{
+				pChunk->bOrdered = FALSE;
+			}
+
+			pChunk->Last       = Address;
+			pChunk->bLastLocal = bLocal;
+		}
+	}
+}
+/******************************************************************************/
+static void PublishChunk(sLoad * pLoad, int Chunk)
+{
+	/* Marks the chunk decoded and publishes the image below the first chunk
+	   with data still to be decoded */
+	int Next;
+
+	EnterCriticalSection(&pLoad->Lock);
+
+	pLoad->pChunks[Chunk].bDecoded = TRUE;
+
+	if(pLoad->pChunks[Chunk].pError != NULL)
+	{
+		pLoad->bOrdered = FALSE;
+	}
+
+	while((pLoad->Decoded < pLoad->ChunkCount) && (pLoad->pChunks[pLoad->Decoded].bDecoded == TRUE))
+	{
+		pLoad->Decoded++;
+	}
+
+	for(Next = pLoad->Decoded; (Next < pLoad->ChunkCount) && ((pLoad->pChunks[Next].bDecoded == TRUE) || (pLoad->pChunks[Next].First == -1)); Next++);
+
+	if((pLoad->bOrdered == TRUE) && (Next < pLoad->ChunkCount))
+	{
+		pLoad->pMemory->Publish(pLoad->pChunks[Next].First / 2);
+	}
+
+	LeaveCriticalSection(&pLoad->Lock);
+}
+/******************************************************************************/
+static void DecodeChunk(sChunk * pChunk, mem_cMemImage * pMemory)
+{
+	int ExtAddr = pChunk->ExtAddr;
+
+	for(const char * pLine = pChunk->pStart; pLine < pChunk->pEnd; )
+	{
+		const char * pNext = NextLine(pLine, pChunk->pEnd);
+		hex_cRecord  Record;
+
+		/* blank lines and line endings are not records */
+		if(pLine[0] != ':')
+		{
+			pLine = pNext;
+			continue;
+		}
+
+		if(Record.Decode(pLine, (int)(pNext - pLine)) != TRUE)
+		{
+			pChunk->pError   = pLine;
+			pChunk->pMessage = "corrupt record";
+			return;
+		}
+
+		if(Record.RecordType() == 0)
+		{
+			unsigned int Address = (Record.Address() + ExtAddr) / 2;
+
+			if(pMemory->InsertData(Address, Record.Words(), Record.WordCount()) != Record.WordCount())
+			{
+				pChunk->pError   = pLine;
+				pChunk->pMessage = "address out of range";
+				return;
+			}
+		}
+		else if(Record.RecordType() == 1)
+		{
+		}
+		else if(Record.RecordType() == 4)
+		{
+			ExtAddr = ((Record.Data()[0] << 8) | Record.Data()[1]) << 16;
+		}
+		else
+		{
+			pChunk->pError   = pLine;
+			pChunk->pMessage = "unknown record type";
+			return;
+		}
+
+		pLine = pNext;
+	}
+}
+/******************************************************************************/
+#ifdef _WIN32
+static unsigned __stdcall LoadThread(void * pParam)
+#else
+static void * LoadThread(void * pParam)
+#endif
+{
+	sLoad * pLoad = (sLoad *)pParam;
+	int     Chunk;
+
+	while((Chunk = InterlockedIncrement(&pLoad->NextChunk) - 1) < pLoad->ChunkCount)
+	{
+		if(pLoad->bDecode == TRUE)
+		{
+			DecodeChunk(&pLoad->pChunks[Chunk], pLoad->pMemory);
+			PublishChunk(pLoad, Chunk);
+		}
+		else
+		{
+			ScanChunk(&pLoad->pChunks[Chunk]);
+		}
+	}
+
+	return 0;
+}
+/******************************************************************************/
+static void RunThreads(sLoad * pLoad, int ThreadCount)
+{
+#ifdef _WIN32
+	HANDLE    Threads[HEX_MAX_THREADS];
+#else
+	pthread_t Threads[HEX_MAX_THREADS];
+#endif
+
+	pLoad->NextChunk = 0;
+
+	if(ThreadCount <= 1)
+	{
+		LoadThread(pLoad);
+		return;
+	}
+
+#ifdef _WIN32
+	for(int Thread = 0; Thread < ThreadCount; Thread++)
+	{
+		Threads[Thread] = (HANDLE)_beginthreadex(NULL, 0, LoadThread, pLoad, 0, NULL);
+		assert(Threads[Thread] != 0);
+	}
+
+	WaitForMultipleObjects(ThreadCount, Threads, TRUE, INFINITE);
+
+	for(int Thread = 0; Thread < ThreadCount; Thread++)
+	{
+		CloseHandle(Threads[Thread]);
+	}
+#else
+	for(int Thread = 0; Thread < ThreadCount; Thread++)
+	{
+		int Result = pthread_create(&Threads[Thread], NULL, LoadThread, pLoad);
+		assert(Result == 0);
+	}
+
+	for(int Thread = 0; Thread < ThreadCount; Thread++)
+	{
+		pthread_join(Threads[Thread], NULL);
+	}
+#endif
+}
+/******************************************************************************/
+static int ProcessorCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO SystemInfo;
+
+	GetSystemInfo(&SystemInfo);
+
+	return (int)SystemInfo.dwNumberOfProcessors;
+#else
+	return max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
+}
+/******************************************************************************/
+static const char * LoadText(const char * pFileName, int Size)
+{
+	/* A heap copy of the file for when it can't be mapped, NULL if it can't
+	   be read either */
+	FILE * pFile;
+	char * pText;
+
+	if((pFile = fopen(pFileName, "rb")) == NULL)
+	{
+		return NULL;
+	}
+
+	pText = (char *)malloc(Size);
+	assert(pText != NULL);
+
+	if((int)fread(pText, 1, Size, pFile) != Size)
+	{
+		free(pText);
+		pText = NULL;
+	}
+
+	fclose(pFile);
+
+	return pText;
+}
+/******************************************************************************/
+static const char * MapFile(const char * pFileName, int * pSize, bool * pbMapped)
+{
+	/* Returns NULL when the file can't be opened, or is empty with *pSize 0.
+	   The view outlives the handles, so they are closed straight away. A
+	   file that can't be mapped is read instead, and *pbMapped is FALSE */
+	const char * pText = NULL;
+
+#ifdef _WIN32
+	HANDLE File;
+	HANDLE Mapping;
+
+	*pSize = -1;
+
+	File = CreateFile(pFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(File == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	*pSize = (int)GetFileSize(File, NULL);
+
+	if(*pSize != 0)
+	{
+		Mapping = CreateFileMapping(File, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		if(Mapping != NULL)
+		{
+			pText = (const char *)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+
+			CloseHandle(Mapping);
+		}
+	}
+
+	CloseHandle(File);
+#else
+	int         File;
+	struct stat Stat;
+
+	*pSize = -1;
+
+	if((File = open(pFileName, O_RDONLY)) < 0)
+	{
+		return NULL;
+	}
+
+	if(fstat(File, &Stat) != 0)
+	{
+		close(File);
+		return NULL;
+	}
+
+	*pSize = (int)Stat.st_size;
+
+	if(*pSize != 0)
+	{
+		void * pView = mmap(NULL, *pSize, PROT_READ, MAP_PRIVATE, File, 0);
+
+		if(pView != MAP_FAILED)
+		{
+			pText = (const char *)pView;
+		}
+	}
+
+	close(File);
+#endif
+
+	*pbMapped = (pText != NULL);
+
+	if((pText == NULL) && (*pSize > 0))
+	{
+		pText = LoadText(pFileName, *pSize);
+	}
+
+	return pText;
+}
+/******************************************************************************/
+static void UnmapFile(const char * pText, int Size, bool bMapped)
+{
+	if(bMapped != TRUE)
+	{
+		free((void *)pText);
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(pText);
+#else
+	munmap((void *)pText, Size);
+#endif
+}
+/******************************************************************************/
+bool hex_LoadFile(const char * pFileName, mem_cMemImage * pMemory)
+{
+	const char * pText;
+	int          Size;
+	sLoad        Load;
+	bool         bResult = TRUE;
+	bool         bMapped;
+
+	pText = MapFile(pFileName, &Size, &bMapped);
+
+	if(Size < 0)
+	{
+		printf("\nCan't open file: %s\n", pFileName);
+		return FALSE;
+	}
+
+	if(Size == 0)
+	{
+		printf("\nBad Hex file: %s is empty\n", pFileName);
+		return FALSE;
+	}
+
+	if(pText == NULL)
+	{
+		printf("\nCan't read file: %s\n", pFileName);
+		return FALSE;
+	}
+
+	/* Cut the file into chunks that start on a record */
+	Load.ChunkCount = (Size + HEX_CHUNK_SIZE - 1) / HEX_CHUNK_SIZE;
+	Load.pChunks    = (sChunk *)calloc(Load.ChunkCount, sizeof(sChunk));
+	Load.pMemory    = pMemory;
+	assert(Load.pChunks != NULL);
+
+	for(int Chunk = 0; Chunk < Load.ChunkCount; Chunk++)
+	{
+		const char * pStart = pText + min(Size, Chunk * HEX_CHUNK_SIZE);
+
+		if(Chunk != 0)
+		{
+			pStart = NextLine(max(pStart - 1, Load.pChunks[Chunk - 1].pStart), pText + Size);
+			Load.pChunks[Chunk - 1].pEnd = pStart;
+		}
+
+		Load.pChunks[Chunk].pStart = pStart;
+	}
+	Load.pChunks[Load.ChunkCount - 1].pEnd = pText + Size;
+
+	int ThreadCount = min(min(ProcessorCount(), Load.ChunkCount), HEX_MAX_THREADS);
+
+	/* First pass: last extended address of each chunk, then carry them
+	   forward, and see whether the records are in address order */
+	Load.bDecode = FALSE;
+	RunThreads(&Load, ThreadCount);
+
+	Load.Decoded  = 0;
+	Load.bOrdered = TRUE;
+
+	for(int Chunk = 0, ExtAddr = 0, Last = -1; Chunk < Load.ChunkCount; Chunk++)
+	{
+		sChunk * pChunk = &Load.pChunks[Chunk];
+
+		pChunk->ExtAddr = ExtAddr;
+
+		if(pChunk->LastExtAddr != -1)
+		{
+			ExtAddr = pChunk->LastExtAddr;
+		}
+
+		if(pChunk->First == -1)
+		{
+			continue;
+		}
+
+		pChunk->First += (pChunk->bFirstLocal == TRUE) ? pChunk->ExtAddr : 0;
+		pChunk->Last  += (pChunk->bLastLocal  == TRUE) ? pChunk->ExtAddr : 0;
+
+		if((pChunk->bOrdered != TRUE) || (pChunk->First < Last) ||
+		   ((pChunk->FarFirst != -1) && (pChunk->LocalLast + pChunk->ExtAddr > pChunk->FarFirst)))
+		{
+			Load.bOrdered = FALSE;
+		}
+
+		Last = pChunk->Last;
+	}
+
+	/* Second pass: decode every chunk into the image */
+	InitializeCriticalSection(&Load.Lock);
+
+	Load.bDecode = TRUE;
+	RunThreads(&Load, ThreadCount);
+
+	DeleteCriticalSection(&Load.Lock);
+
+	for(int Chunk = 0; Chunk < Load.ChunkCount; Chunk++)
+	{
+		const char * pError = Load.pChunks[Chunk].pError;
+
+		if(pError != NULL)
+		{
+			int Length = (int)(NextLine(pError, pText + Size) - pError);
+
+			while((Length > 0) && ((pError[Length - 1] == '\n') || (pError[Length - 1] == '\r')))
+			{
+				Length--;
+			}
+
+			printf("\nBad Hex file: %s: %.*s\n", Load.pChunks[Chunk].pMessage, Length, pError);
+			bResult = FALSE;
+			break;
+		}
+	}
+
+	free(Load.pChunks);
+	UnmapFile(pText, Size, bMapped);
+
+	return bResult;
+}
+/******************************************************************************/
+void hex_Benchmark(const char * pFileName)
+{
+	/* Decodes every data record of the file repeatedly, first the way the
+	   programmer used to (sscanf per header and per word) and then with
+	   hex_cRecord, and reports the throughput of each. No target is needed. */
+	char         * pText;
+	long           TextSize;
+	unsigned short Words[(HEX_MAX_DATA + 1) / 2];
+	hex_cRecord    Record;
+	FILE         * pFile;
+
+	if((pFile = fopen(pFileName, "r")) == NULL)
+	{
+		printf("\nCan't open file: %s\n", pFileName);
+		return;
+	}
+
+	fseek(pFile, 0, SEEK_END);
+	TextSize = ftell(pFile);
+	pText    = (char *)malloc(TextSize + 1);
+	assert(pText != NULL);
+	rewind(pFile);
+
+	/* one NUL terminated string per line */
+	TextSize        = (long)fread(pText, 1, TextSize, pFile);
+	pText[TextSize] = '\0';
+
+	for(long Count = 0; Count < TextSize; Count++)
+	{
+		if(pText[Count] == '\n')
+		{
+			pText[Count] = '\0';
+		}
+	}
+
+	for(int Method = 0; Method < 2; Method++)
+	{
+		clock_t Start  = clock();
+		clock_t Ticks  = 0;
+		int     Passes = 0;
+		int     Errors = 0;
+
+		while(Ticks < CLOCKS_PER_SEC)
+		{
+			for(char * pLine = pText; pLine < pText + TextSize; pLine += strlen(pLine) + 1)
+			{
+				if(pLine[0] != ':')
+				{
+					continue;
+				}
+
+				if(Method == 0)
+				{
+					int ByteCount;
+					int Address;
+					int RecordType;
+
+					sscanf(pLine+1, "%2x%4x%2x", &ByteCount, &Address, &RecordType);
+
+					for(int CharCount = 0; CharCount < ByteCount*2; CharCount += 4)
+					{
+						sscanf(pLine + 9 + CharCount, "%4hx", &Words[CharCount / 4]);
+					}
+				}
+				else if(Record.Decode(pLine, (int)strlen(pLine)) != TRUE)
+				{
+					Errors++;
+				}
+			}
+
+			Passes++;
+			Ticks = clock() - Start;
+		}
+
+		printf("%-8s %6d passes  %8.1f MB/s%s\n",
+			   (Method == 0) ? "sscanf" : "table",
+			   Passes,
+			   ((double)TextSize * Passes / (1024.0 * 1024.0)) / ((double)Ticks / CLOCKS_PER_SEC),
+			   (Errors != 0) ? "  (bad records)" : "");
+	}
+
+	free(pText);
+	fclose(pFile);
+}
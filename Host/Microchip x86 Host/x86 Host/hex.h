@@ -0,0 +1,33 @@
+#ifndef _hex_h
+#define _hex_h
+
+#define HEX_MAX_DATA   255
+#define HEX_CHUNK_SIZE (64 * 1024)
+#define HEX_MAX_THREADS 64
+
+class hex_cRecord
+{
+public:
+	hex_cRecord();
+
+	bool Decode(const char * pLine, int Length);
+
+	int                     ByteCount()  { return m_ByteCount; }
+	unsigned int            Address()    { return m_Address; }
+	int                     RecordType() { return m_RecordType; }
+	unsigned char         * Data()       { return m_Bytes + 4; }
+	const unsigned short  * Words()      { return m_Words; }
+	int                     WordCount()  { return (m_ByteCount + 1) / 2; }
+
+private:
+	int              m_ByteCount;
+	unsigned int     m_Address;
+	int              m_RecordType;
+	unsigned char    m_Bytes[4 + HEX_MAX_DATA + 1];
+	unsigned short   m_Words[(HEX_MAX_DATA + 1) / 2];
+};
+
+bool hex_LoadFile (const char * pFileName, mem_cMemImage * pMemory);
+void hex_Benchmark(const char * pFileName);
+
+#endif
@@ -0,0 +1,564 @@
+/******************************************************************************\
+ *
+ *  lnk is the byte stream between the programmer and the bootloader. The
+ *  protocol code only sees lnk_cLink; lnk_Open picks the transport from
+ *  the interface name:
+ *
+ *    tcp:host:port  a serial server bridge, raw bytes over TCP
+ *    emu[:caps]     the bootloader model in emu, in process, advertising
+ *                   caps, in hex, rather than all it can do
+ *    pty            a new pseudo-terminal for a simulator to attach to
+ *                   (not on Windows)
+ *    anything else  a serial port, COM1 or /dev/ttyUSB0
+ *
+ *  lnk_cLoopback is an in-process pair of ends with no I/O at all, for
+ *  running the protocol against a model of the bootloader.
+ *
+ *  Reads take an absolute deadline from lnk_Deadline, so a caller reading
+ *  a reply in several pieces waits no longer than for the whole reply.
+ *  Writes take a list of buffers, so a header, payload and trailer go out
+ *  in one call without being copied together first.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+/******************************************************************************/
+DWORD lnk_Deadline(int Timeout)
+{
+	return GetTickCount() + (DWORD)Timeout;
+}
+/******************************************************************************/
+int lnk_Remaining(DWORD Deadline)
+{
+	int Remaining = (int)(Deadline - GetTickCount());
+
+	return((Remaining > 0) ? Remaining : 0);
+}
+/******************************************************************************/
+lnk_cLink * lnk_Open(char * pName, char * pBaudRate)
+{
+	if(strncmp(pName, "tcp:", 4) == 0)
+	{
+		lnk_cTcp * pTcp = new lnk_cTcp();
+
+		if(pTcp->Open(pName + 4) != TRUE)
+		{
+			delete pTcp;
+			return NULL;
+		}
+
+		return pTcp;
+	}
+
+	if(strcmp(pName, "emu") == 0)
+	{
+		return emu_Open(EMU_CAPS);
+	}
+
+	if(strncmp(pName, "emu:", 4) == 0)
+	{
+		return emu_Open((int)strtol(pName + 4, NULL, 16));
+	}
+
+#ifndef _WIN32
+	if(strcmp(pName, "pty") == 0)
+	{
+		lnk_cPty * pPty = new lnk_cPty();
+
+		if(pPty->Open() != TRUE)
+		{
+			delete pPty;
+			return NULL;
+		}
+
+		printf("\nOpened pseudo-terminal %s\n", pPty->Name());
+
+		return pPty;
+	}
+#endif
+
+	lnk_cSerial * pSerial = new lnk_cSerial();
+
+	if(pSerial->Open(pName, pBaudRate) != TRUE)
+	{
+		delete pSerial;
+		return NULL;
+	}
+
+	return pSerial;
+}
+/******************************************************************************/
+bool lnk_cLink::Write(const char * pBuffer, int Size)
+{
+	lnk_sBuffer Buffer = {pBuffer, Size};
+
+	return Write(&Buffer, 1);
+}
+/******************************************************************************/
+bool lnk_cLink::Write(const lnk_sBuffer * pBuffers, int Count)
+{
+	assert(Count <= LNK_MAX_BUFFERS);
+
+	for(int Buffer = 0; Buffer < Count; Buffer++)
+	{
+		m_BytesOut += pBuffers[Buffer].Size;
+	}
+
+	return Send(pBuffers, Count);
+}
+/******************************************************************************/
+bool lnk_cLink::Receive(char * pBuffer, int Size, int Timeout)
+{
+	return ReceiveUntil(pBuffer, Size, lnk_Deadline(Timeout));
+}
+/******************************************************************************/
+bool lnk_cLink::ReceiveUntil(char * pBuffer, int Size, DWORD Deadline)
+{
+	int Received = 0;
+
+	while(Received != Size)
+	{
+		int Length = Read(pBuffer + Received, Size - Received, Deadline);
+
+		m_BytesIn += Length;
+
+		if((Length == 0) && (lnk_Remaining(Deadline) == 0))
+		{
+			return FALSE;
+		}
+
+		Received += Length;
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+lnk_cSerial::lnk_cSerial()
+: m_ComDev(INVALID_HANDLE_VALUE)
+{ }
+/******************************************************************************/
+lnk_cSerial::~lnk_cSerial()
+{
+	if(m_ComDev != INVALID_HANDLE_VALUE)
+	{
+		CloseConnection(&m_ComDev);
+	}
+}
+/******************************************************************************/
+bool lnk_cSerial::Open(char * pPortName, char * pBaudRate)
+{
+	return(OpenConnection(&m_ComDev, pPortName, pBaudRate) != INVALID_HANDLE_VALUE);
+}
+/******************************************************************************/
+int lnk_cSerial::Read(char * pBuffer, int MaxLength, DWORD Deadline)
+{
+	return ReadCommBlock(&m_ComDev, pBuffer, MaxLength, lnk_Remaining(Deadline));
+}
+/******************************************************************************/
+bool lnk_cSerial::Send(const lnk_sBuffer * pBuffers, int Count)
+{
+	return(WriteCommBlock(&m_ComDev, pBuffers, Count) == TRUE);
+}
+/******************************************************************************/
+bool lnk_cSerial::SetBaudRate(int BaudRate)
+{
+	return(::SetBaudRate(&m_ComDev, BaudRate) == TRUE);
+}
+/******************************************************************************/
+int lnk_cSerial::BaudRate(void)
+{
+	return GetBaudRate(&m_ComDev);
+}
+/******************************************************************************/
+bool lnk_cSerial::SetFlowControl(bool bEnable)
+{
+	return(::SetFlowControl(&m_ComDev, bEnable) == TRUE);
+}
+/******************************************************************************/
+void lnk_cSerial::Purge(void)
+{
+	PurgeConnection(&m_ComDev);
+}
+#ifndef _WIN32
+/******************************************************************************/
+lnk_cPty::lnk_cPty()
+: m_Slave(INVALID_HANDLE_VALUE)
+{
+	m_Name[0] = '\0';
+}
+/******************************************************************************/
+lnk_cPty::~lnk_cPty()
+{
+	if(m_Slave != INVALID_HANDLE_VALUE)
+	{
+		CloseConnection(&m_Slave);
+	}
+}
+/******************************************************************************/
+bool lnk_cPty::Open(void)
+{
+	/* The master is driven like a serial port: its termios calls reach the
+	   slave, so a simulator on the slave sees the baud rate change. Holding
+	   the slave open keeps the master from reading a hangup before the
+	   simulator attaches, and makes it raw from the start */
+	m_ComDev = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if(m_ComDev == INVALID_HANDLE_VALUE)
+	{
+		return FALSE;
+	}
+
+	if((grantpt(m_ComDev) != 0) || (unlockpt(m_ComDev) != 0) || (ptsname(m_ComDev) == NULL))
+	{
+		return FALSE;
+	}
+
+	strncpy(m_Name, ptsname(m_ComDev), sizeof(m_Name) - 1);
+	m_Name[sizeof(m_Name) - 1] = '\0';
+
+	return(OpenConnection(&m_Slave, m_Name, "115200") != INVALID_HANDLE_VALUE);
+}
+#endif
+/******************************************************************************/
+lnk_cTcp::lnk_cTcp()
+: m_Socket(INVALID_SOCKET)
+{
+#ifdef _WIN32
+	static bool bStarted = FALSE;
+	WSADATA     WsaData;
+
+	if(bStarted == FALSE)
+	{
+		bStarted = (WSAStartup(MAKEWORD(2, 2), &WsaData) == 0);
+	}
+#endif
+}
+/******************************************************************************/
+lnk_cTcp::~lnk_cTcp()
+{
+	if(m_Socket != INVALID_SOCKET)
+	{
+		closesocket(m_Socket);
+	}
+}
+/******************************************************************************/
+bool lnk_cTcp::Open(const char * pAddress)
+{
+	/* pAddress is host:port */
+	char              Host[256];
+	const char *      pPort = strrchr(pAddress, ':');
+	struct addrinfo   Hints;
+	struct addrinfo * pResults;
+	int               NoDelay = 1;
+
+	if((pPort == NULL) || (pPort - pAddress >= (int)sizeof(Host)))
+	{
+		return FALSE;
+	}
+
+	memcpy(Host, pAddress, pPort - pAddress);
+	Host[pPort - pAddress] = '\0';
+
+	memset(&Hints, 0, sizeof(Hints));
+	Hints.ai_family   = AF_UNSPEC;
+	Hints.ai_socktype = SOCK_STREAM;
+
+	if(getaddrinfo(Host, pPort + 1, &Hints, &pResults) != 0)
+	{
+		return FALSE;
+	}
+
+	for(struct addrinfo * pResult = pResults; pResult != NULL; pResult = pResult->ai_next)
+	{
+		m_Socket = socket(pResult->ai_family, pResult->ai_socktype, pResult->ai_protocol);
+
+		if(m_Socket == INVALID_SOCKET)
+		{
+			continue;
+		}
+
+		if(connect(m_Socket, pResult->ai_addr, (int)pResult->ai_addrlen) == 0)
+		{
+			break;
+		}
+
+		closesocket(m_Socket);
+		m_Socket = INVALID_SOCKET;
+	}
+
+	freeaddrinfo(pResults);
+
+	if(m_Socket == INVALID_SOCKET)
+	{
+		return FALSE;
+	}
+
+	/* every request waits on its reply, so don't let Nagle hold it back */
+	setsockopt(m_Socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&NoDelay, sizeof(NoDelay));
+
+	return TRUE;
+}
+/******************************************************************************/
+int lnk_cTcp::Read(char * pBuffer, int MaxLength, DWORD Deadline)
+{
+	fd_set         Readable;
+	struct timeval Timeout;
+	int            Remaining = lnk_Remaining(Deadline);
+	int            Length;
+
+	FD_ZERO(&Readable);
+	FD_SET(m_Socket, &Readable);
+
+	Timeout.tv_sec  = Remaining / 1000;
+	Timeout.tv_usec = (Remaining % 1000) * 1000;
+
+	if(select((int)m_Socket + 1, &Readable, NULL, NULL, &Timeout) <= 0)
+	{
+		return 0;
+	}
+
+	Length = recv(m_Socket, pBuffer, MaxLength, 0);
+
+	if(Length <= 0)
+	{
+		/* the bridge has gone; wait out the deadline like a silent port */
+		Sleep(Remaining);
+		return 0;
+	}
+
+	return Length;
+}
+/******************************************************************************/
+bool lnk_cTcp::Send(const lnk_sBuffer * pBuffers, int Count)
+{
+#ifdef _WIN32
+	WSABUF Buffers[LNK_MAX_BUFFERS];
+	DWORD  Sent;
+
+	for(int Buffer = 0; Buffer < Count; Buffer++)
+	{
+		Buffers[Buffer].buf = (CHAR *)pBuffers[Buffer].pData;
+		Buffers[Buffer].len = pBuffers[Buffer].Size;
+	}
+
+	/* a blocking socket only completes once everything is sent */
+	return(WSASend(m_Socket, Buffers, Count, &Sent, 0, NULL, NULL) == 0);
+#else
+	struct iovec  Buffers[LNK_MAX_BUFFERS];
+	struct msghdr Message;
+
+	for(int Buffer = 0; Buffer < Count; Buffer++)
+	{
+		Buffers[Buffer].iov_base = (void *)pBuffers[Buffer].pData;
+		Buffers[Buffer].iov_len  = pBuffers[Buffer].Size;
+	}
+
+	memset(&Message, 0, sizeof(Message));
+	Message.msg_iov    = Buffers;
+	Message.msg_iovlen = Count;
+
+	while(Message.msg_iovlen > 0)
+	{
+		ssize_t Sent = sendmsg(m_Socket, &Message, MSG_NOSIGNAL);
+
+		if(Sent < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return FALSE;
+		}
+
+		/* step past whatever went out */
+		while((Message.msg_iovlen > 0) && (Sent >= (ssize_t)Message.msg_iov->iov_len))
+		{
+			Sent -= Message.msg_iov->iov_len;
+			Message.msg_iov++;
+			Message.msg_iovlen--;
+		}
+
+		if(Message.msg_iovlen > 0)
+		{
+			Message.msg_iov->iov_base  = (char *)Message.msg_iov->iov_base + Sent;
+			Message.msg_iov->iov_len  -= Sent;
+		}
+	}
+
+	return TRUE;
+#endif
+}
+/******************************************************************************/
+void lnk_cTcp::Purge(void)
+{
+	char Buffer[256];
+
+	while(Read(Buffer, sizeof(Buffer), GetTickCount()) > 0)
+	{
+	}
+}
+/******************************************************************************/
+lnk_cLoopback::lnk_cLoopback()
+: m_pPipe(new sPipe),
+  m_Side(0)
+{
+	InitializeCriticalSection(&m_pPipe->Lock);
+	InitializeConditionVariable(&m_pPipe->Changed);
+
+	m_pPipe->Queues[0].Head  = 0;
+	m_pPipe->Queues[0].Count = 0;
+	m_pPipe->Queues[1].Head  = 0;
+	m_pPipe->Queues[1].Count = 0;
+	m_pPipe->BaudRate        = 0;
+	m_pPipe->Ends            = 1;
+}
+/******************************************************************************/
+lnk_cLoopback::lnk_cLoopback(lnk_cLoopback * pPeer)
+: m_pPipe(pPeer->m_pPipe),
+  m_Side(1 - pPeer->m_Side)
+{
+	EnterCriticalSection(&m_pPipe->Lock);
+	m_pPipe->Ends++;
+	LeaveCriticalSection(&m_pPipe->Lock);
+}
+/******************************************************************************/
+lnk_cLoopback::~lnk_cLoopback()
+{
+	EnterCriticalSection(&m_pPipe->Lock);
+	int Ends = --m_pPipe->Ends;
+	WakeAllConditionVariable(&m_pPipe->Changed);
+	LeaveCriticalSection(&m_pPipe->Lock);
+
+	if(Ends == 0)
+	{
+		DeleteCriticalSection(&m_pPipe->Lock);
+		delete m_pPipe;
+	}
+}
+/******************************************************************************/
+int lnk_cLoopback::Read(char * pBuffer, int MaxLength, DWORD Deadline)
+{
+	sQueue * pQueue = &m_pPipe->Queues[1 - m_Side];
+	int      Length = 0;
+
+	EnterCriticalSection(&m_pPipe->Lock);
+
+	/* nothing more can arrive once the other end is gone */
+	while((pQueue->Count == 0) && (m_pPipe->Ends == 2) && (lnk_Remaining(Deadline) > 0))
+	{
+		SleepConditionVariableCS(&m_pPipe->Changed, &m_pPipe->Lock, lnk_Remaining(Deadline));
+	}
+
+	while((Length < MaxLength) && (pQueue->Count > 0))
+	{
+		int Chunk = min(min(MaxLength - Length, pQueue->Count), LNK_LOOPBACK_SIZE - pQueue->Head);
+
+		memcpy(pBuffer + Length, pQueue->Data + pQueue->Head, Chunk);
+
+		pQueue->Head   = (pQueue->Head + Chunk) % LNK_LOOPBACK_SIZE;
+		pQueue->Count -= Chunk;
+		Length        += Chunk;
+	}
+
+	if(Length > 0)
+	{
+		WakeAllConditionVariable(&m_pPipe->Changed);
+	}
+
+	LeaveCriticalSection(&m_pPipe->Lock);
+
+	return Length;
+}
+/******************************************************************************/
+bool lnk_cLoopback::Send(const lnk_sBuffer * pBuffers, int Count)
+{
+	sQueue * pQueue = &m_pPipe->Queues[m_Side];
+	bool     bSent  = TRUE;
+
+	EnterCriticalSection(&m_pPipe->Lock);
+
+	for(int Buffer = 0; (Buffer < Count) && (bSent == TRUE); Buffer++)
+	{
+		const char * pData = pBuffers[Buffer].pData;
+		int          Size  = pBuffers[Buffer].Size;
+
+		while(Size > 0)
+		{
+			/* a full queue holds the writer off, like flow control */
+			while((pQueue->Count == LNK_LOOPBACK_SIZE) && (m_pPipe->Ends == 2))
+			{
+				SleepConditionVariableCS(&m_pPipe->Changed, &m_pPipe->Lock, INFINITE);
+			}
+
+			if(m_pPipe->Ends != 2)
+			{
+				bSent = FALSE;
+				break;
+			}
+
+			int Tail  = (pQueue->Head + pQueue->Count) % LNK_LOOPBACK_SIZE;
+			int Chunk = min(min(Size, LNK_LOOPBACK_SIZE - pQueue->Count), LNK_LOOPBACK_SIZE - Tail);
+
+			memcpy(pQueue->Data + Tail, pData, Chunk);
+
+			pQueue->Count += Chunk;
+			pData         += Chunk;
+			Size          -= Chunk;
+
+			WakeAllConditionVariable(&m_pPipe->Changed);
+		}
+	}
+
+	LeaveCriticalSection(&m_pPipe->Lock);
+
+	return bSent;
+}
+/******************************************************************************/
+bool lnk_cLoopback::SetBaudRate(int BaudRate)
+{
+	/* no wire, but the far end may model one at this rate */
+	EnterCriticalSection(&m_pPipe->Lock);
+	m_pPipe->BaudRate = BaudRate;
+	LeaveCriticalSection(&m_pPipe->Lock);
+
+	return TRUE;
+}
+/******************************************************************************/
+int lnk_cLoopback::BaudRate(void)
+{
+	EnterCriticalSection(&m_pPipe->Lock);
+	int BaudRate = m_pPipe->BaudRate;
+	LeaveCriticalSection(&m_pPipe->Lock);
+
+	return BaudRate;
+}
+/******************************************************************************/
+bool lnk_cLoopback::SetFlowControl(bool)
+{
+	/* a full queue always holds the writer off */
+	return TRUE;
+}
+/******************************************************************************/
+void lnk_cLoopback::Purge(void)
+{
+	EnterCriticalSection(&m_pPipe->Lock);
+	m_pPipe->Queues[1 - m_Side].Head  = 0;
+	m_pPipe->Queues[1 - m_Side].Count = 0;
+	WakeAllConditionVariable(&m_pPipe->Changed);
+	LeaveCriticalSection(&m_pPipe->Lock);
+}
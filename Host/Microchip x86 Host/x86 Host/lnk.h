@@ -0,0 +1,146 @@
+#ifndef _lnk_h
+#define _lnk_h
+
+#define LNK_MAX_BUFFERS   8
+#define LNK_LOOPBACK_SIZE (64 * 1024)
+
+typedef struct
+{
+	const char * pData;
+	int          Size;
+} lnk_sBuffer;
+
+class lnk_cLink
+{
+public:
+	lnk_cLink() : m_BytesOut(0), m_BytesIn(0), m_Seq(0) { }
+	virtual ~lnk_cLink() { }
+
+	bool Write  (const char * pBuffer, int Size);
+	bool Write  (const lnk_sBuffer * pBuffers, int Count);
+	bool Receive(char * pBuffer, int Size, int Timeout);
+	bool ReceiveUntil(char * pBuffer, int Size, DWORD Deadline);
+
+	/* Returns the bytes read, 0 if none arrived before Deadline */
+	virtual int  Read          (char * pBuffer, int MaxLength, DWORD Deadline) = 0;
+	virtual bool SetBaudRate   (int BaudRate) = 0;
+	virtual int  BaudRate      (void) = 0; /* 0 if the link has no rate of its own */
+	virtual bool SetFlowControl(bool bEnable) = 0;
+	virtual void Purge         (void) = 0;
+
+	/* Bytes written and received through the calls above */
+	int BytesOut(void) { return m_BytesOut; }
+	int BytesIn (void) { return m_BytesIn; }
+
+	/* Frame sequence numbers are per link, so links driven from different
+	   threads don't share a counter */
+	int NextSeq(void) { m_Seq = (m_Seq + 1) & 0xFF; return m_Seq; }
+
+protected:
+	virtual bool Send(const lnk_sBuffer * pBuffers, int Count) = 0;
+
+private:
+	int m_BytesOut;
+	int m_BytesIn;
+	int m_Seq;
+};
+
+class lnk_cSerial : public lnk_cLink
+{
+public:
+	lnk_cSerial();
+	~lnk_cSerial();
+
+	bool Open(char * pPortName, char * pBaudRate);
+
+	int  Read          (char * pBuffer, int MaxLength, DWORD Deadline);
+	bool SetBaudRate   (int BaudRate);
+	int  BaudRate      (void);
+	bool SetFlowControl(bool bEnable);
+	void Purge         (void);
+
+protected:
+	bool Send(const lnk_sBuffer * pBuffers, int Count);
+
+	HANDLE m_ComDev;
+};
+
+#ifndef _WIN32
+class lnk_cPty : public lnk_cSerial
+{
+public:
+	lnk_cPty();
+	~lnk_cPty();
+
+	bool         Open(void);
+	const char * Name(void) { return m_Name; }
+
+private:
+	HANDLE m_Slave;
+	char   m_Name[MAX_PATH];
+};
+#endif
+
+class lnk_cTcp : public lnk_cLink
+{
+public:
+	lnk_cTcp();
+	~lnk_cTcp();
+
+	bool Open(const char * pAddress);
+
+	int  Read          (char * pBuffer, int MaxLength, DWORD Deadline);
+	bool SetBaudRate   (int)           { return FALSE; }
+	int  BaudRate      (void)          { return 0; }
+	bool SetFlowControl(bool)          { return FALSE; }
+	void Purge         (void);
+
+protected:
+	bool Send(const lnk_sBuffer * pBuffers, int Count);
+
+private:
+	SOCKET m_Socket;
+};
+
+class lnk_cLoopback : public lnk_cLink
+{
+public:
+	lnk_cLoopback();
+	lnk_cLoopback(lnk_cLoopback * pPeer);
+	~lnk_cLoopback();
+
+	int  Read          (char * pBuffer, int MaxLength, DWORD Deadline);
+	bool SetBaudRate   (int BaudRate);
+	int  BaudRate      (void);
+	bool SetFlowControl(bool bEnable);
+	void Purge         (void);
+
+protected:
+	bool Send(const lnk_sBuffer * pBuffers, int Count);
+
+private:
+	struct sQueue
+	{
+		char Data[LNK_LOOPBACK_SIZE];
+		int  Head;
+		int  Count;
+	};
+
+	struct sPipe
+	{
+		CRITICAL_SECTION   Lock;
+		CONDITION_VARIABLE Changed;
+		sQueue             Queues[2];
+		int                BaudRate;
+		int                Ends;
+	};
+
+	sPipe * m_pPipe;
+	int     m_Side;
+};
+
+lnk_cLink * lnk_Open     (char * pName, char * pBaudRate);
+DWORD       lnk_Deadline (int Timeout);
+int         lnk_Remaining(DWORD Deadline);
+
+#endif
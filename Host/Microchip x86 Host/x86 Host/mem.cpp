@@ -1,32 +1,74 @@
 #include "stdafx.h"
 
+struct sFlight
+{
+	int    Row;
+	int    Seq;
+	int    Tries;
+	double Sent;
+};
+
+/******************************************************************************/
+mem_cArena::mem_cArena()
+: m_pBlocks(NULL),
+  m_Used(0),
+  m_Reserved(0)
+{ }
+/******************************************************************************/
+mem_cArena::~mem_cArena()
+{
+	while(m_pBlocks != NULL)
+	{
+		sBlock * pNext = m_pBlocks->pNext;
+
+		free(m_pBlocks);
+		m_pBlocks = pNext;
+	}
+}
+/******************************************************************************/
+void * mem_cArena::Alloc(int Size)
+{
+	/* Bump allocator: memory is only returned when the arena is destroyed */
+	Size = (Size + 7) & ~7;
+
+	if((m_pBlocks == NULL) || (m_pBlocks->Used + Size > m_pBlocks->Size))
+	{
+		int      BlockSize = max(Size, MEM_ARENA_BLOCK);
+		sBlock * pBlock    = (sBlock *)malloc(sizeof(sBlock) + BlockSize);
+
+		assert(pBlock != NULL);
+
+		pBlock->pNext = m_pBlocks;
+		pBlock->Size  = BlockSize;
+		pBlock->Used  = 0;
+		m_pBlocks     = pBlock;
+		m_Reserved   += BlockSize;
+	}
+
+	void * pMemory = (char *)(m_pBlocks + 1) + m_pBlocks->Used;
 
-extern BOOL   WriteCommBlock (HANDLE *pComdDev, char *pBuffer ,  int BytesToWrite);
-extern void   ReceiveData(HANDLE *pComDev, char * pBuffer, int BytesToReceive);
+	m_pBlocks->Used += Size;
+	m_Used          += Size;
 
+	return pMemory;
+}
 /******************************************************************************/
-mem_cMemRow::mem_cMemRow(eType Type, unsigned int StartAddr, int RowNumber, eFamily Family)
+mem_cMemRow::mem_cMemRow(eType Type, unsigned int StartAddr, int RowNumber, const sDevice * pDevice, mem_cArena * pArena)
 {
 	int Size;
+	int DataSize;
 
 
 
 	m_RowNumber = RowNumber;
-	m_eFamily    = Family;
 	m_eType     = Type;
 	m_bEmpty    = TRUE;
+	m_bFormatted = FALSE;
 	
 
 	if(m_eType == Program)
 	{
-		if(m_eFamily == dsPIC30F)
-		{
-			m_RowSize = PM30F_ROW_SIZE;
-		}
-		else
-		{
-			m_RowSize = PM33F_ROW_SIZE;
-		}
+		m_RowSize = pDevice->PageSize;
 	}
 	else
 	{
@@ -36,115 +78,216 @@ mem_cMemRow::mem_cMemRow(eType Type, unsigned int StartAddr, int RowNumber, eFam
 	if(m_eType == Program)
 	{
 		Size = m_RowSize * 3;
+		DataSize = m_RowSize * 2;
 		m_Address = StartAddr + RowNumber * m_RowSize * 2;
 	}
-	if(m_eType == EEProm)
+	else if(m_eType == EEProm)
 	{
 		Size = m_RowSize * 2;
+		DataSize = m_RowSize * 2;
 		m_Address = StartAddr + RowNumber * m_RowSize * 2;
 	}
-	if(m_eType == Configuration)
+	else
 	{
 		Size = 3;
+		DataSize = 2;
 		m_Address = StartAddr + RowNumber * 2;
 	}
 
-	m_pBuffer   = (char *)malloc(Size);
+	m_Size      = Size;
+	m_pBuffer   = (char *)pArena->Alloc(Size);
+	m_pData     = (unsigned short *)pArena->Alloc(sizeof(unsigned short) * DataSize);
 
-	memset(m_Data, 0xFFFF, sizeof(unsigned short)*PM33F_ROW_SIZE*2);	
+	memset(m_pBuffer, 0xFF, Size);
+	memset(m_pData, 0xFF, sizeof(unsigned short) * DataSize);	
 }
 /******************************************************************************/
-bool mem_cMemRow::InsertData(unsigned int Address, char * pData)
+int mem_cMemRow::InsertData(unsigned int Address, const unsigned short * pWords, int Count)
 {
-	if(Address < m_Address)
+	/* Copies as many of the words as fall inside this row, starting at
+	   Address, and returns how many were taken. */
+	unsigned int EndAddress;
+
+	if(m_eType == Configuration)
 	{
-		return FALSE;
+		EndAddress = m_Address + 2;
 	}
-
-	if((m_eType == Program) && (Address >= (m_Address + m_RowSize * 2)))
+	else
 	{
-		return FALSE;
+		EndAddress = m_Address + m_RowSize * 2;
 	}
 
-	if((m_eType == EEProm) && (Address >= (m_Address + m_RowSize * 2)))
+	if((Address < m_Address) || (Address >= EndAddress))
 	{
-		return FALSE;
+		return 0;
 	}
 
-	if((m_eType == Configuration) && (Address >= (m_Address + 2)))
+	if(Count > (int)(EndAddress - Address))
 	{
-		return FALSE;
+		Count = EndAddress - Address;
 	}
 
 	m_bEmpty    = FALSE;
 
-	sscanf(pData, "%4hx", &(m_Data[Address - m_Address]));
+	memcpy(&m_pData[Address - m_Address], pWords, Count * sizeof(unsigned short));
 	
-	return TRUE;
+	return Count;
 }
 /******************************************************************************/
 void mem_cMemRow::FormatData(void)
 {
-	if(m_bEmpty == TRUE)
+	if((m_bEmpty == TRUE) || (m_bFormatted == TRUE))
 	{
 		return;
 	}
 
+	m_bFormatted = TRUE;
+
 	if(m_eType == Program)
 	{
 		for(int Count = 0; Count < m_RowSize; Count += 1)
 		{
-			m_pBuffer[0 + Count * 3] = (m_Data[Count * 2]     >> 8) & 0xFF;
-			m_pBuffer[1 + Count * 3] = (m_Data[Count * 2])          & 0xFF;
-			m_pBuffer[2 + Count * 3] = (m_Data[Count * 2 + 1] >> 8) & 0xFF;
+			m_pBuffer[0 + Count * 3] = (m_pData[Count * 2]     >> 8) & 0xFF;
+			m_pBuffer[1 + Count * 3] = (m_pData[Count * 2])          & 0xFF;
+			m_pBuffer[2 + Count * 3] = (m_pData[Count * 2 + 1] >> 8) & 0xFF;
 		}
 	}
 	else if(m_eType == Configuration)
 	{
-		m_pBuffer[0] = (m_Data[0]  >> 8) & 0xFF;
-		m_pBuffer[1] = (m_Data[0])       & 0xFF;
-		m_pBuffer[2] = (m_Data[1]  >> 8) & 0xFF;
+		m_pBuffer[0] = (m_pData[0]  >> 8) & 0xFF;
+		m_pBuffer[1] = (m_pData[0])       & 0xFF;
+		m_pBuffer[2] = (m_pData[1]  >> 8) & 0xFF;
 	}
 	else
 	{
 		for(int Count = 0; Count < m_RowSize; Count++)
 		{
-			m_pBuffer[0 + Count * 2] = (m_Data[Count * 2] >> 8) & 0xFF;
-			m_pBuffer[1 + Count * 2] = (m_Data[Count * 2])      & 0xFF;
+			m_pBuffer[0 + Count * 2] = (m_pData[Count * 2] >> 8) & 0xFF;
+			m_pBuffer[1 + Count * 2] = (m_pData[Count * 2])      & 0xFF;
 		}
 	}
 }
 /******************************************************************************/
-void mem_cMemRow::SendData(HANDLE *pComDev)
+void mem_cMemRow::LoadData(const char * pBuffer)
+{
+	/* Takes an already formatted payload, e.g. from a firmware image cache */
+	memcpy(m_pBuffer, pBuffer, m_Size);
+
+	m_bEmpty     = FALSE;
+	m_bFormatted = TRUE;
+}
+/******************************************************************************/
+void mem_cMemRow::PatchData(unsigned int Address, const char * pBytes, int Count)
 {
+	/* Overwrites Count program words of the formatted payload, 3 bytes each,
+	   starting at Address */
+	assert(m_eType == Program);
+	assert((Address >= m_Address) && (Address + Count * 2 <= m_Address + m_RowSize * 2));
+
+	m_bEmpty = FALSE;
+
+	FormatData();
+
+	memcpy(m_pBuffer + (Address - m_Address) / 2 * 3, pBytes, Count * 3);
+}
+/******************************************************************************/
+bool mem_cMemRow::IsBlank(void)
+{
+	/* A formatted row that is all 0xFF only needs erasing */
+	for(int Count = 0; Count < m_Size; Count++)
+	{
+		if((m_pBuffer[Count] & 0xFF) != 0xFF)
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+int mem_cMemRow::Request(char * pBuffer, int Caps)
+{
+	/* Builds the write command for a program or EEPROM row and returns its
+	   size. A program row goes compressed whenever the bootloader can take
+	   it and it gets smaller. pBuffer must hold RLE_MAX_SIZE(PM33F_ROW_SIZE)
+	   bytes after the command. */
+	int Size;
+
+	assert(m_eType != Configuration);
+	assert(m_RowSize <= PM33F_ROW_SIZE);
+
+	if(m_eType == EEProm)
+	{
+		pBuffer[0] = COMMAND_WRITE_EE;
+		Size       = m_RowSize * 2;
+		memcpy(pBuffer + 4, m_pBuffer, Size);
+	}
+	else if((Caps & CAPS_ERASE_PM) && IsBlank())
+	{
+		pBuffer[0] = COMMAND_ERASE_PM;
+		Size       = 0;
+	}
+	else if((Caps & CAPS_WRITE_PM_RLE) && ((Size = rle_Encode(m_pBuffer, m_RowSize, pBuffer + 4)) < m_RowSize * 3))
+	{
+		pBuffer[0] = COMMAND_WRITE_PM_RLE;
+	}
+	else
+	{
+		pBuffer[0] = COMMAND_WRITE_PM;
+		Size       = m_RowSize * 3;
+		memcpy(pBuffer + 4, m_pBuffer, Size);
+	}
+
+	pBuffer[1] = (m_Address)       & 0xFF;
+	pBuffer[2] = (m_Address >> 8)  & 0xFF;
+	pBuffer[3] = (m_Address >> 16) & 0xFF;
+
+	return(4 + Size);
+}
+/******************************************************************************/
+void mem_cMemRow::WriteRequest(lnk_cLink *pLink, int Caps)
+{
+	/* Sends the write command for a program row without waiting for the
+	   acknowledgement, so several rows can be in flight */
+	char Buffer[4 + RLE_MAX_SIZE(PM33F_ROW_SIZE)];
+
+	assert(m_eType == Program);
+
+	pLink->Write(Buffer, Request(Buffer, Caps));
+}
+/******************************************************************************/
+void mem_cMemRow::SendFrame(lnk_cLink *pLink, int Caps, int Seq)
+{
+	char Buffer[4 + RLE_MAX_SIZE(PM33F_ROW_SIZE)];
+
+	frm_Send(pLink, Seq, Buffer, Request(Buffer, Caps));
+}
+/******************************************************************************/
+bool mem_cMemRow::SendData(lnk_cLink *pLink, int Caps)
+{
+	/* Sends the row unframed until it is acknowledged, giving up with
+	   FALSE after MEM_RETRIES tries. Only a reply other than an ACK is
+	   answered with a resend: without frames the bootloader can't tell a
+	   resend from the rest of a row it is still reading, so if no reply
+	   comes in time the session is over and FALSE is returned at once */
 	char Buffer[4] = {0,0,0,0};
 
 	if((m_bEmpty == TRUE) && (m_eType != Configuration))
 	{
-		return;
+		return(TRUE);
 	}
 
-	while(Buffer[0] != COMMAND_ACK)
+	for(int Try = 0; Try < MEM_RETRIES; Try++)
 	{
 		if(m_eType == Program)
 		{
-			Buffer[0] = COMMAND_WRITE_PM;
-			Buffer[1] = (m_Address)       & 0xFF;
-			Buffer[2] = (m_Address >> 8)  & 0xFF;
-			Buffer[3] = (m_Address >> 16) & 0xFF;
-
-			WriteCommBlock(pComDev, Buffer, 4);
-			WriteCommBlock(pComDev, m_pBuffer, m_RowSize * 3);
+			WriteRequest(pLink, Caps);
 		}
 		else if(m_eType == EEProm)
 		{
-			Buffer[0] = COMMAND_WRITE_EE;
-			Buffer[1] = (m_Address)       & 0xFF;
-			Buffer[2] = (m_Address >> 8)  & 0xFF;
-			Buffer[3] = (m_Address >> 16) & 0xFF;
+			char Request[4 + RLE_MAX_SIZE(PM33F_ROW_SIZE)];
 
-			WriteCommBlock(pComDev, Buffer, 4);
-			WriteCommBlock(pComDev, m_pBuffer, m_RowSize * 2);
+			pLink->Write(Request, this->Request(Request, Caps));
 		}
 		else if((m_eType == Configuration) && (m_RowNumber == 0))
 		{
@@ -153,21 +296,16 @@ void mem_cMemRow::SendData(HANDLE *pComDev)
 			Buffer[2] = m_pBuffer[0];
 			Buffer[3] = m_pBuffer[1];
 
-			WriteCommBlock(pComDev, Buffer, 4);
+			pLink->Write(Buffer, 4);
 			
 		}
 		else if((m_eType == Configuration) && (m_RowNumber != 0))
 		{
-			if((m_eFamily == dsPIC30F) && (m_RowNumber == 7))
-			{
-				return;
-			}
-
 			Buffer[0] = (char)(m_bEmpty)& 0xFF;
 			Buffer[1] = m_pBuffer[0];
 			Buffer[2] = m_pBuffer[1];
 
-			WriteCommBlock(pComDev, Buffer, 3);
+			pLink->Write(Buffer, 3);
 
 		}
 
@@ -176,7 +314,838 @@ void mem_cMemRow::SendData(HANDLE *pComDev)
 			assert(!"Unknown memory type");
 		}
 
-		ReceiveData(pComDev, Buffer, 1);
+		if(pLink->Receive(Buffer, 1, READ_BUFFER_TIMEOUT) != TRUE)
+		{
+			printf("\nNo acknowledgement for row at 0x%06x\n", m_Address);
+
+			return(FALSE);
+		}
+
+		if(Buffer[0] == COMMAND_ACK)
+		{
+			return(TRUE);
+		}
+	}
+
+	printf("\nNo acknowledgement for row at 0x%06x after %d tries\n", m_Address, MEM_RETRIES);
+
+	return(FALSE);
+}
+/******************************************************************************/
+mem_cMemImage::mem_cMemImage(const sDevice * pDevice)
+{
+	/* Rows cover the device's own memories and no more: its program
+	   memory in pages, its data EEPROM and its configuration words */
+	m_pDevice    = pDevice;
+	m_RowSize    = pDevice->PageSize;
+	m_PMRows     = (pDevice->PMSize + m_RowSize * 2 - 1) / (m_RowSize * 2);
+	m_EERows     = pDevice->EESize / (EE30F_ROW_SIZE * 2);
+	m_CMRows     = pDevice->ConfigWords;
+	m_Rows       = m_PMRows + m_EERows + m_CMRows;
+	m_RowCount   = 0;
+	m_pTelemetry = NULL;
+	m_pBase      = NULL;
+	m_Ready      = m_Rows;
+	m_bFailed    = FALSE;
+
+	assert(m_RowSize <= PM33F_ROW_SIZE);
+	assert(m_CMRows <= MEM_MAX_CONFIG);
+
+	m_pRows = new mem_cMemRow * volatile [m_Rows];
+
+	memset((void *)m_pRows, 0, m_Rows * sizeof(*m_pRows));
+
+	InitializeCriticalSection(&m_Lock);
+	InitializeConditionVariable(&m_Published);
+
+	/* Configuration rows are always sent, programmed or not */
+	for(int Row = 0; Row < m_CMRows; Row++)
+	{
+		CreateRow(m_PMRows + m_EERows + Row);
+	}
+}
+/******************************************************************************/
+mem_cMemImage::mem_cMemImage(mem_cMemImage * pBase)
+{
+	/* A view of a formatted image sharing its rows, so several targets can
+	   be programmed from one parse. A row the view patches is copied first
+	   and the base is never written; the base must outlive the view. The
+	   base may still be loading: the view takes up its rows as they are
+	   published, m_Ready counting those taken so far. */
+	m_pDevice    = pBase->m_pDevice;
+	m_RowSize    = pBase->m_RowSize;
+	m_PMRows     = pBase->m_PMRows;
+	m_EERows     = pBase->m_EERows;
+	m_CMRows     = pBase->m_CMRows;
+	m_Rows       = pBase->m_Rows;
+	m_RowCount   = pBase->m_RowCount;
+	m_pTelemetry = NULL;
+	m_pBase      = pBase;
+	m_Ready      = 0;
+	m_bFailed    = FALSE;
+
+	m_pRows = new mem_cMemRow * volatile [m_Rows];
+
+	memcpy((void *)m_pRows, (const void *)pBase->m_pRows, m_Rows * sizeof(*m_pRows));
+
+	InitializeCriticalSection(&m_Lock);
+	InitializeConditionVariable(&m_Published);
+}
+/******************************************************************************/
+mem_cMemImage::~mem_cMemImage()
+{
+	delete [] m_pRows;
+
+	DeleteCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+int mem_cMemImage::FindRow(unsigned int Address)
+{
+	/* Rows are laid out back to back from each region's start address, so the
+	   row holding an address follows directly from its offset. Returns -1 for
+	   addresses outside PM, EE and configuration memory of the device. */
+	unsigned int PMEnd   = PM_START + (unsigned int)(m_PMRows * m_RowSize * 2);
+	unsigned int EEStart = EE_END - (unsigned int)(m_EERows * EE30F_ROW_SIZE * 2);
+	unsigned int CMEnd   = CM_START + (unsigned int)(m_CMRows * 2);
+
+	if(Address < PMEnd)
+	{
+		return((Address - PM_START) / (m_RowSize * 2));
 	}
 
+	if((Address >= EEStart) && (Address < EE_END))
+	{
+		return(m_PMRows + (Address - EEStart) / (EE30F_ROW_SIZE * 2));
+	}
+
+	if((Address >= CM_START) && (Address < CMEnd))
+	{
+		return(m_PMRows + m_EERows + (Address - CM_START) / 2);
+	}
+
+	return(-1);
+}
+/******************************************************************************/
+int mem_cMemImage::RowBytes(int Row)
+{
+	/* Size of the formatted payload of a row */
+	if(Row < m_PMRows)
+	{
+		return(m_RowSize * 3);
+	}
+
+	if(Row < m_PMRows + m_EERows)
+	{
+		return(EE30F_ROW_SIZE * 2);
+	}
+
+	return(3);
+}
+/******************************************************************************/
+mem_cMemRow * mem_cMemImage::CreateRow(int Row)
+{
+	/* Rows may be created by several loader threads at once. A row is only
+	   published in m_pRows once it is fully constructed, so readers that find
+	   it there don't need the lock. */
+	mem_cMemRow * pRow;
+
+	EnterCriticalSection(&m_Lock);
+
+	if((pRow = m_pRows[Row]) == NULL)
+	{
+		void * pMemory = m_Arena.Alloc(sizeof(mem_cMemRow));
+
+		if(Row < m_PMRows)
+		{
+			pRow = new(pMemory) mem_cMemRow(mem_cMemRow::Program, PM_START, Row, m_pDevice, &m_Arena);
+		}
+		else if(Row < m_PMRows + m_EERows)
+		{
+			pRow = new(pMemory) mem_cMemRow(mem_cMemRow::EEProm, EE_END - m_EERows * EE30F_ROW_SIZE * 2, Row - m_PMRows, m_pDevice, &m_Arena);
+		}
+		else
+		{
+			pRow = new(pMemory) mem_cMemRow(mem_cMemRow::Configuration, CM_START, Row - m_PMRows - m_EERows, m_pDevice, &m_Arena);
+		}
+
+		m_pRows[Row] = pRow;
+		m_RowCount++;
+	}
+
+	LeaveCriticalSection(&m_Lock);
+
+	return pRow;
+}
+/******************************************************************************/
+int mem_cMemImage::InsertData(unsigned int Address, const unsigned short * pWords, int Count)
+{
+	/* Inserts the words across as many rows as they span. Returns the number
+	   of words inserted, which is short of Count if an address is out of
+	   range. Words for the bootloader's own program memory are passed over,
+	   so its rows are never written, as a dump of the whole target holds
+	   them. */
+	int Inserted = 0;
+
+	while(Inserted < Count)
+	{
+		int           Row = FindRow(Address);
+		int           Size;
+		mem_cMemRow * pRow;
+
+		if((Address >= m_pDevice->BootStart) && (Address < m_pDevice->BootEnd))
+		{
+			Size = min(Count - Inserted, (int)(m_pDevice->BootEnd - Address));
+
+			Address  += Size;
+			Inserted += Size;
+			continue;
+		}
+
+		if(Row < 0)
+		{
+			break;
+		}
+
+		if((pRow = m_pRows[Row]) == NULL)
+		{
+			pRow = CreateRow(Row);
+		}
+
+		Size = pRow->InsertData(Address, pWords + Inserted, Count - Inserted);
+
+		Address  += Size;
+		Inserted += Size;
+	}
+
+	return Inserted;
+}
+/******************************************************************************/
+void mem_cMemImage::FormatData(void)
+{
+	for(int Row = 0; Row < m_Rows; Row++)
+	{
+		if(m_pRows[Row] != NULL)
+		{
+			m_pRows[Row]->FormatData();
+		}
+	}
+}
+/******************************************************************************/
+void mem_cMemImage::LoadRow(int Row, const char * pBuffer)
+{
+	CreateRow(Row)->LoadData(pBuffer);
+}
+/******************************************************************************/
+void mem_cMemImage::PatchData(unsigned int Address, const char * pBytes, int Count)
+{
+	int Row = FindRow(Address);
+
+	assert((Row >= 0) && (Row < m_PMRows));
+
+	WaitRows(Row + 1, TRUE);
+
+	if((m_pBase != NULL) && (m_pRows[Row] != NULL) && (m_pRows[Row] == m_pBase->m_pRows[Row]))
+	{
+		mem_cMemRow * pShared = m_pRows[Row];
+
+		m_pRows[Row] = NULL;
+		m_RowCount--;
+
+		CreateRow(Row)->LoadData(pShared->Buffer());
+	}
+
+	CreateRow(Row)->PatchData(Address, pBytes, Count);
+}
+/******************************************************************************/
+void mem_cMemImage::BeginLoad(void)
+{
+	/* No row is final until the loader publishes it */
+	EnterCriticalSection(&m_Lock);
+
+	m_Ready   = 0;
+	m_bFailed = FALSE;
+
+	LeaveCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+void mem_cMemImage::Publish(unsigned int Address)
+{
+	/* The loader will write nothing more below Address: the program rows
+	   there are formatted and handed to whoever is waiting on them */
+	int Rows = min((int)((Address - PM_START) / (m_RowSize * 2)), m_PMRows);
+
+	EnterCriticalSection(&m_Lock);
+
+	for(; m_Ready < Rows; m_Ready++)
+	{
+		if(m_pRows[m_Ready] != NULL)
+		{
+			m_pRows[m_Ready]->FormatData();
+		}
+	}
+
+	WakeAllConditionVariable(&m_Published);
+
+	LeaveCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+void mem_cMemImage::EndLoad(bool bLoaded)
+{
+	/* Every row is final, or the load failed and nothing more will come.
+	   The loader has formatted the image. */
+	EnterCriticalSection(&m_Lock);
+
+	m_Ready   = m_Rows;
+	m_bFailed = (bLoaded != TRUE);
+
+	WakeAllConditionVariable(&m_Published);
+
+	LeaveCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+int mem_cMemImage::WaitRows(int Rows, bool bWait)
+{
+	/* Returns how many leading rows are final, first waiting until there
+	   are at least Rows if bWait */
+	mem_cMemImage * pLoad = (m_pBase != NULL) ? m_pBase : this;
+	int             Ready;
+
+	EnterCriticalSection(&pLoad->m_Lock);
+
+	while((bWait == TRUE) && (pLoad->m_Ready < Rows))
+	{
+		SleepConditionVariableCS(&pLoad->m_Published, &pLoad->m_Lock, INFINITE);
+	}
+
+	Ready = pLoad->m_Ready;
+
+	LeaveCriticalSection(&pLoad->m_Lock);
+
+	/* A view takes up the rows its base has created since */
+	for(; (m_pBase != NULL) && (m_Ready < Ready); m_Ready++)
+	{
+		if((m_pRows[m_Ready] == NULL) && (m_pBase->m_pRows[m_Ready] != NULL))
+		{
+			m_pRows[m_Ready] = m_pBase->m_pRows[m_Ready];
+			m_RowCount++;
+		}
+	}
+
+	return Ready;
+}
+/******************************************************************************/
+bool mem_cMemImage::Failed(void)
+{
+	mem_cMemImage * pLoad = (m_pBase != NULL) ? m_pBase : this;
+	bool            bFailed;
+
+	EnterCriticalSection(&pLoad->m_Lock);
+	bFailed = pLoad->m_bFailed;
+	LeaveCriticalSection(&pLoad->m_Lock);
+
+	return bFailed;
+}
+/******************************************************************************/
+mem_cMemRow * mem_cMemImage::NextRow(int * pRow, const bool * pbUnchanged, bool bWait)
+{
+	/* Returns the next program row to send from *pRow on, moving *pRow past
+	   it. NULL once every row has been taken, which *pRow reaching m_PMRows
+	   tells apart from the next row not being final yet when not bWait. */
+	while(*pRow < m_PMRows)
+	{
+		mem_cMemRow * pNext;
+
+		if(WaitRows(*pRow + 1, bWait) <= *pRow)
+		{
+			return NULL;
+		}
+
+		if(Failed() == TRUE)
+		{
+			*pRow = m_PMRows;
+			return NULL;
+		}
+
+		pNext = m_pRows[(*pRow)++];
+
+		if((pNext != NULL) && (pNext->IsEmpty() != TRUE) && (pbUnchanged[*pRow - 1] != TRUE))
+		{
+			return pNext;
+		}
+	}
+
+	return NULL;
+}
+/******************************************************************************/
+bool mem_cMemImage::SendData(lnk_cLink *pLink, int Caps, int Window)
+{
+	/* Sends the image with the per row bookkeeping sized to the device */
+	bool          * pbUnchanged = new bool[m_PMRows];
+	mem_cMemRow  ** pQueue      = new mem_cMemRow * [m_PMRows];
+	bool            bSent;
+
+	memset(pbUnchanged, 0, m_PMRows * sizeof(bool));
+
+	bSent = SendRows(pLink, Caps, Window, pbUnchanged, pQueue);
+
+	delete [] pQueue;
+	delete [] pbUnchanged;
+
+	return bSent;
+}
+/******************************************************************************/
+bool mem_cMemImage::SendRows(lnk_cLink *pLink, int Caps, int Window, bool * pbUnchanged, mem_cMemRow ** pQueue)
+{
+	/* Program rows are streamed with up to Window of them awaiting their
+	   acknowledgement; a row that isn't acknowledged is resent on its own
+	   once the stream is done. Other rows are sent one at a time. Either
+	   way the transfer gives up, returning FALSE, once a row has run out
+	   of retries. Unframed, only a NACKed row is resent; one whose
+	   acknowledgement doesn't arrive in time ends the transfer at once,
+	   and the caller leaves the target in the bootloader unreset.
+
+	   Rows are sent as soon as the loader publishes them, so the link
+	   needn't wait for the whole file to be parsed. Comparing CRCs with
+	   the target takes the whole image, so that waits for the load. If the
+	   load fails FALSE is returned; the loader has said why. pbUnchanged
+	   and pQueue hold a flag and a row for each program row. */
+	mem_cMemRow * pRow;
+	double        SentAt[MEM_MAX_WINDOW];
+	int           Next   = 0;
+	int           Sent   = 0;
+	int           Nacked = 0;
+
+	if(Caps & CAPS_READ_CRC)
+	{
+		WaitRows(m_Rows, TRUE);
+
+		if(Failed() == TRUE)
+		{
+			return(FALSE);
+		}
+
+		ReadCrc(pLink, Caps, pbUnchanged);
+	}
+
+	Window = max(1, min(Window, MEM_MAX_WINDOW));
+
+	if(Caps & CAPS_FRAMED)
+	{
+		if(SendFrames(pLink, Caps, Window, pbUnchanged, pQueue) != TRUE)
+		{
+			return(FALSE);
+		}
+
+		WaitRows(m_Rows, TRUE);
+
+		if(Failed() == TRUE)
+		{
+			return(FALSE);
+		}
+
+		for(int Row = m_PMRows; Row < m_PMRows + m_EERows; Row++)
+		{
+			if((m_pRows[Row] != NULL) && (m_pRows[Row]->IsEmpty() != TRUE))
+			{
+				char Request[4 + RLE_MAX_SIZE(PM33F_ROW_SIZE)];
+				char Response;
+
+				if(frm_Request(pLink, Caps, Request, m_pRows[Row]->Request(Request, Caps), &Response, 1) != TRUE)
+				{
+					return(FALSE);
+				}
+			}
+		}
+
+		return(SendConfigFrame(pLink, Caps));
+	}
+
+	for(int Acked = 0; ; Acked++)
+	{
+		char Response;
+
+		/* Only wait on the loader with nothing in flight */
+		while((Sent - Acked < Window) && ((pRow = NextRow(&Next, pbUnchanged, Sent == Acked)) != NULL))
+		{
+			pQueue[Sent]                  = pRow;
+			SentAt[Sent % MEM_MAX_WINDOW] = bch_Now();
+
+			SendRow(pLink, Caps, pQueue[Sent++], -1, 0);
+		}
+
+		if(Acked == Sent)
+		{
+			break;
+		}
+
+		if(pLink->Receive(&Response, 1, READ_BUFFER_TIMEOUT) != TRUE)
+		{
+			printf("\nNo acknowledgement for row at 0x%06x\n", pQueue[Acked]->Address());
+
+			return(FALSE);
+		}
+
+		if(Response != COMMAND_ACK)
+		{
+			pQueue[Nacked++] = pQueue[Acked];
+
+			if(m_pTelemetry != NULL)
+			{
+				m_pTelemetry->RowNacked(pQueue[Acked]->Address(), -1);
+			}
+		}
+		else if(m_pTelemetry != NULL)
+		{
+			m_pTelemetry->RowAcked(pQueue[Acked]->Address(), -1, bch_Now() - SentAt[Acked % MEM_MAX_WINDOW], COMMAND_ACK);
+		}
+	}
+
+	WaitRows(m_Rows, TRUE);
+
+	if(Failed() == TRUE)
+	{
+		return(FALSE);
+	}
+
+	for(int Row = 0; Row < Nacked; Row++)
+	{
+		int    BytesOut = pLink->BytesOut();
+		double Start    = bch_Now();
+
+		if(pQueue[Row]->SendData(pLink, Caps) != TRUE)
+		{
+			return(FALSE);
+		}
+
+		if(m_pTelemetry != NULL)
+		{
+			m_pTelemetry->RowSent(pQueue[Row]->Address(), -1, 1, pLink->BytesOut() - BytesOut);
+			m_pTelemetry->RowAcked(pQueue[Row]->Address(), -1, bch_Now() - Start, COMMAND_ACK);
+		}
+	}
+
+	for(int Row = m_PMRows; Row < m_Rows; Row++)
+	{
+		if((m_pRows[Row] != NULL) && (m_pRows[Row]->SendData(pLink, Caps) != TRUE))
+		{
+			return(FALSE);
+		}
+	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+bool mem_cMemImage::SendFrames(lnk_cLink *pLink, int Caps, int Window, const bool * pbUnchanged, mem_cMemRow ** pQueue)
+{
+	/* Streams program rows as frames with up to Window awaiting a reply,
+	   oldest first in Flight. The bootloader answers frames in order, so a
+	   reply to one frame means any frame sent before it was lost: only those
+	   and NACKed rows are resent. If nothing comes back in time, everything
+	   in flight is resent. */
+	sFlight       Flight[MEM_MAX_WINDOW];
+	mem_cMemRow * pRow;
+	char          Buffer[FRM_MAX_SIZE];
+	int           InFlight = 0;
+	int           Count    = 0;
+	int           Next     = 0;
+
+	for(;;)
+	{
+		int Size;
+		int Seq;
+		int Resend;
+
+		/* Only wait on the loader with nothing in flight */
+		while((InFlight < Window) && ((pRow = NextRow(&Next, pbUnchanged, InFlight == 0)) != NULL))
+		{
+			pQueue[Count]          = pRow;
+			Flight[InFlight].Row   = Count++;
+			Flight[InFlight].Seq   = frm_NextSeq(pLink);
+			Flight[InFlight].Tries = 0;
+			Flight[InFlight].Sent  = bch_Now();
+
+			SendRow(pLink, Caps, pQueue[Flight[InFlight].Row], Flight[InFlight].Seq, 0);
+
+			InFlight++;
+		}
+
+		if(InFlight == 0)
+		{
+			break;
+		}
+
+		Size   = frm_Receive(pLink, &Seq, Buffer, lnk_Deadline(frm_Timeout(pLink, InFlight * FRM_MAX_SIZE)));
+		Resend = InFlight;
+
+		if(Size >= 0)
+		{
+			/* A reply to a frame no longer in flight is a late duplicate */
+			for(Resend = 0; (Resend < InFlight) && (Flight[Resend].Seq != Seq); Resend++);
+
+			if(Resend == InFlight)
+			{
+				continue;
+			}
+
+			if((Size == 1) && ((Buffer[0] == COMMAND_ACK) || (Buffer[0] == ACK_UNCHANGED) || (Buffer[0] == ACK_NO_ERASE)))
+			{
+				if(m_pTelemetry != NULL)
+				{
+					m_pTelemetry->RowAcked(pQueue[Flight[Resend].Row]->Address(), Seq, bch_Now() - Flight[Resend].Sent, Buffer[0]);
+				}
+
+				memmove(&Flight[Resend], &Flight[Resend + 1], (InFlight - Resend - 1) * sizeof(sFlight));
+				InFlight--;
+			}
+			else
+			{
+				if(m_pTelemetry != NULL)
+				{
+					m_pTelemetry->RowNacked(pQueue[Flight[Resend].Row]->Address(), Seq);
+				}
+
+				Resend++;
+			}
+		}
+
+		/* Move the rows to resend from the front to the back */
+		for(; Resend > 0; Resend--)
+		{
+			sFlight Row = Flight[0];
+
+			if(++Row.Tries > FRM_RETRIES)
+			{
+				printf("\nNo acknowledgement for row at 0x%06x after %d tries\n", pQueue[Row.Row]->Address(), FRM_RETRIES);
+				return(FALSE);
+			}
+
+			memmove(&Flight[0], &Flight[1], (InFlight - 1) * sizeof(sFlight));
+			Row.Sent             = bch_Now();
+			Flight[InFlight - 1] = Row;
+
+			SendRow(pLink, Caps, pQueue[Row.Row], Row.Seq, Row.Tries);
+		}
+	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+bool mem_cMemImage::SendConfigFrame(lnk_cLink *pLink, int Caps)
+{
+	/* All configuration words go in one COMMAND_WRITE_CM frame, each with
+	   its empty flag, and each is acknowledged in the reply. A device with
+	   none at CM_START gets no frame. */
+	char Buffer[1 + MEM_MAX_CONFIG * 3];
+	char Response[MEM_MAX_CONFIG];
+
+	if(m_CMRows == 0)
+	{
+		return(TRUE);
+	}
+
+	Buffer[0] = COMMAND_WRITE_CM;
+
+	for(int Row = 0; Row < m_CMRows; Row++)
+	{
+		mem_cMemRow * pRow = m_pRows[m_PMRows + m_EERows + Row];
+
+		Buffer[1 + Row * 3] = (char)(pRow->IsEmpty());
+		Buffer[2 + Row * 3] = pRow->Buffer()[0];
+		Buffer[3 + Row * 3] = pRow->Buffer()[1];
+	}
+
+	return(frm_Request(pLink, Caps, Buffer, 1 + m_CMRows * 3, Response, m_CMRows));
+}
+/******************************************************************************/
+void mem_cMemImage::SendRow(lnk_cLink *pLink, int Caps, mem_cMemRow * pRow, int Seq, int Try)
+{
+	/* A program row as a frame, or as a bare request if Seq is -1 */
+	int BytesOut = pLink->BytesOut();
+
+	if(Seq < 0)
+	{
+		pRow->WriteRequest(pLink, Caps);
+	}
+	else
+	{
+		pRow->SendFrame(pLink, Caps, Seq);
+	}
+
+	if(m_pTelemetry != NULL)
+	{
+		m_pTelemetry->RowSent(pRow->Address(), Seq, Try, pLink->BytesOut() - BytesOut);
+	}
+}
+/******************************************************************************/
+void mem_cMemImage::ReadCrc(lnk_cLink *pLink, int Caps, bool * pbUnchanged)
+{
+	/* Fetches the CRC of every program row up to the last one in the image
+	   and flags the rows whose formatted payload already matches the target */
+	int  LastRow   = -1;
+	int  Rows      = 0;
+	int  Unchanged = 0;
+
+	for(int Row = 0; Row < m_PMRows; Row++)
+	{
+		if((m_pRows[Row] != NULL) && (m_pRows[Row]->IsEmpty() != TRUE))
+		{
+			LastRow = Row;
+			Rows++;
+		}
+	}
+
+	for(int FirstRow = 0; FirstRow <= LastRow; FirstRow += 255)
+	{
+		int Count = min(255, LastRow + 1 - FirstRow);
+
+		if(ReadRowCrcs(pLink, Caps, FirstRow, Count, pbUnchanged + FirstRow) != TRUE)
+		{
+			break;
+		}
+	}
+
+	for(int Row = 0; Row <= LastRow; Row++)
+	{
+		if(pbUnchanged[Row] == TRUE)
+		{
+			Unchanged++;
+		}
+	}
+
+	tel_Print("\n%d of %d program rows unchanged", Unchanged, Rows);
+
+	if(m_pTelemetry != NULL)
+	{
+		m_pTelemetry->Unchanged(Unchanged);
+	}
+}
+/******************************************************************************/
+bool mem_cMemImage::ReadRowCrcs(lnk_cLink *pLink, int Caps, int FirstRow, int Count, bool * pbMatch)
+{
+	/* Fetches the CRCs of up to 255 program rows from FirstRow with one
+	   COMMAND_READ_CRC and flags the rows of the image that match. Returns
+	   FALSE if the target doesn't answer. */
+	char         Buffer[4 + 255 * 4];
+	unsigned int Address = PM_START + FirstRow * m_RowSize * 2;
+
+	assert(Count <= 255);
+
+	Buffer[0] = COMMAND_READ_CRC;
+	Buffer[1] = (Address)       & 0xFF;
+	Buffer[2] = (Address >> 8)  & 0xFF;
+	Buffer[3] = (Address >> 16) & 0xFF;
+	Buffer[4] = (char)Count;
+
+	if(frm_Request(pLink, Caps, Buffer, 5, Buffer, Count * 4) != TRUE)
+	{
+		return(FALSE);
+	}
+
+	for(int Row = 0; Row < Count; Row++)
+	{
+		mem_cMemRow   * pRow = m_pRows[FirstRow + Row];
+		unsigned char * pCrc = (unsigned char *)Buffer + Row * 4;
+
+		if((pRow != NULL) && (pRow->IsEmpty() != TRUE))
+		{
+			pbMatch[Row] = (crc_Crc32(pRow->Buffer(), pRow->Size()) == (pCrc[0] | (pCrc[1] << 8) | (pCrc[2] << 16) | ((unsigned int)pCrc[3] << 24)));
+		}
+	}
+
+	return(TRUE);
+}
+/******************************************************************************/
+int mem_cMemImage::Verify(lnk_cLink *pLink, int Caps)
+{
+	/* Compares the program rows of the image with the target and returns
+	   how many differ, or -1 if the target can't be asked. Each run of
+	   consecutive rows takes one COMMAND_CRC_RANGE, so a matching image
+	   costs a few round trips; a run that doesn't match is checked row by
+	   row to name the rows that differ. */
+	int Differ = 0;
+
+	if((Caps & (CAPS_CRC_RANGE | CAPS_READ_CRC)) == 0)
+	{
+		return(-1);
+	}
+
+	WaitRows(m_Rows, TRUE);
+
+	for(int FirstRow = 0; FirstRow < m_PMRows; )
+	{
+		bool bMatch[MEM_VERIFY_ROWS];
+		int  Count = 0;
+
+		while((FirstRow + Count < m_PMRows) && (Count < MEM_VERIFY_ROWS) &&
+		      (m_pRows[FirstRow + Count] != NULL) && (m_pRows[FirstRow + Count]->IsEmpty() != TRUE))
+		{
+			bMatch[Count++] = FALSE;
+		}
+
+		if(Count == 0)
+		{
+			FirstRow++;
+			continue;
+		}
+
+		if(Caps & CAPS_CRC_RANGE)
+		{
+			unsigned int   Address      = PM_START + FirstRow * m_RowSize * 2;
+			unsigned int   Instructions = Count * m_RowSize;
+			unsigned int   Crc          = 0;
+			char           Buffer[7];
+			unsigned char  Reply[4];
+
+			for(int Row = FirstRow; Row < FirstRow + Count; Row++)
+			{
+				Crc = crc_Crc32Update(Crc, m_pRows[Row]->Buffer(), m_pRows[Row]->Size());
+			}
+
+			Buffer[0] = COMMAND_CRC_RANGE;
+			Buffer[1] = (Address)            & 0xFF;
+			Buffer[2] = (Address >> 8)       & 0xFF;
+			Buffer[3] = (Address >> 16)      & 0xFF;
+			Buffer[4] = (Instructions)       & 0xFF;
+			Buffer[5] = (Instructions >> 8)  & 0xFF;
+			Buffer[6] = (Instructions >> 16) & 0xFF;
+
+			if(frm_Request(pLink, Caps, Buffer, 7, (char *)Reply, 4) != TRUE)
+			{
+				return(-1);
+			}
+
+			if(Crc == (Reply[0] | (Reply[1] << 8) | (Reply[2] << 16) | ((unsigned int)Reply[3] << 24)))
+			{
+				FirstRow += Count;
+				continue;
+			}
+		}
+
+		if((Caps & CAPS_READ_CRC) && (ReadRowCrcs(pLink, Caps, FirstRow, Count, bMatch) != TRUE))
+		{
+			return(-1);
+		}
+
+		for(int Row = 0; Row < Count; Row++)
+		{
+			if(bMatch[Row] != TRUE)
+			{
+				tel_Print("\nRow at 0x%06x differs", m_pRows[FirstRow + Row]->Address());
+				Differ++;
+			}
+		}
+
+		FirstRow += Count;
+	}
+
+	return(Differ);
+}
+/******************************************************************************/
+void mem_cMemImage::PrintUsage(void)
+{
+	tel_Print("\nMemory image: %d of %d rows, %d KB used, %d KB reserved\n",
+		   m_RowCount,
+		   m_Rows,
+		   (m_Arena.Used() + 1023) / 1024,
+		   (m_Arena.Reserved() + 1023) / 1024);
 }
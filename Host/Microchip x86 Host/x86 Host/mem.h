@@ -1,6 +1,40 @@
 #ifndef _mem_h
 #define _mem_h
 
+#define PM_START 0x000000
+#define EE_END   0x800000 /* data EEPROM ends here, starting sDevice::EESize bytes below */
+#define CM_START 0xF80000
+
+#define MEM_ARENA_BLOCK (64 * 1024)
+#define MEM_MAX_WINDOW  32
+#define MEM_VERIFY_ROWS 32 /* program rows to one COMMAND_CRC_RANGE, bounding the target's time on it */
+#define MEM_MAX_CONFIG  8  /* configuration words of any device */
+#define MEM_RETRIES     8  /* tries at an unframed row before giving up */
+
+class mem_cArena
+{
+public:
+	mem_cArena();
+	~mem_cArena();
+
+	void * Alloc(int Size);
+
+	int Used()     { return m_Used; }
+	int Reserved() { return m_Reserved; }
+
+private:
+	struct sBlock
+	{
+		sBlock * pNext;
+		int      Size;
+		int      Used;
+	};
+
+	sBlock * m_pBlocks;
+	int      m_Used;
+	int      m_Reserved;
+};
+
 class mem_cMemRow
 {
 public:
@@ -11,22 +45,94 @@ public:
 		EEProm,
 		Configuration
 	};
-	mem_cMemRow(eType Type, unsigned int StartAddr, int RowNumber, eFamily Family);
+	mem_cMemRow(eType Type, unsigned int StartAddr, int RowNumber, const sDevice * pDevice, mem_cArena * pArena);
 
-	bool InsertData(unsigned int Address, char * pData);
+	int  InsertData(unsigned int Address, const unsigned short * pWords, int Count);
 	void FormatData(void);
-	void SendData  (HANDLE *pComDev);
+	void LoadData  (const char * pBuffer);
+	void PatchData (unsigned int Address, const char * pBytes, int Count);
+	bool IsBlank   (void);
+	int  Request   (char * pBuffer, int Caps);
+	void WriteRequest(lnk_cLink *pLink, int Caps);
+	void SendFrame (lnk_cLink *pLink, int Caps, int Seq);
+	bool SendData  (lnk_cLink *pLink, int Caps);
+
+	bool   IsEmpty() { return m_bEmpty; }
+	char * Buffer()  { return m_pBuffer; }
+	int    Size()    { return m_Size; }
+	unsigned int Address() { return m_Address; }
 
 private:
 	char           * m_pBuffer;
+	int              m_Size;
 	unsigned int     m_Address;
 	bool             m_bEmpty;
+	bool             m_bFormatted;
 	eType            m_eType;
-	unsigned short   m_Data[PM33F_ROW_SIZE*2];
+	unsigned short * m_pData;
 	int              m_RowNumber;
-	eFamily          m_eFamily;
 	int				 m_RowSize;
 };
 
+class mem_cMemImage
+{
+public:
+	mem_cMemImage(const sDevice * pDevice);
+	mem_cMemImage(mem_cMemImage * pBase);
+	~mem_cMemImage();
+
+	int  FindRow   (unsigned int Address);
+	int  RowBytes  (int Row);
+	int  InsertData(unsigned int Address, const unsigned short * pWords, int Count);
+	void FormatData(void);
+	void LoadRow   (int Row, const char * pBuffer);
+	void PatchData (unsigned int Address, const char * pBytes, int Count);
+	bool SendData  (lnk_cLink *pLink, int Caps, int Window);
+	int  Verify    (lnk_cLink *pLink, int Caps);
+	void PrintUsage(void);
+
+	/* Loading while the image is being sent: rows become final in address
+	   order as the loader publishes them */
+	void BeginLoad(void);
+	void Publish  (unsigned int Address);
+	void EndLoad  (bool bLoaded);
+	int  WaitRows (int Rows, bool bWait);
+	bool Failed   (void);
+
+	mem_cMemRow   * Row(int Row)  { return m_pRows[Row]; }
+	int             Rows()        { return m_Rows; }
+	int             ProgramRows() { return m_PMRows; }
+	const sDevice * Device()      { return m_pDevice; }
+
+	/* Reports every program row sent and answered */
+	void SetTelemetry(tel_cSession * pTelemetry) { m_pTelemetry = pTelemetry; }
+
+private:
+	mem_cMemRow * CreateRow(int Row);
+	mem_cMemRow * NextRow  (int * pRow, const bool * pbUnchanged, bool bWait);
+	void          ReadCrc  (lnk_cLink *pLink, int Caps, bool * pbUnchanged);
+	bool          ReadRowCrcs(lnk_cLink *pLink, int Caps, int FirstRow, int Count, bool * pbMatch);
+	bool          SendRows (lnk_cLink *pLink, int Caps, int Window, bool * pbUnchanged, mem_cMemRow ** pQueue);
+	bool          SendFrames(lnk_cLink *pLink, int Caps, int Window, const bool * pbUnchanged, mem_cMemRow ** pQueue);
+	void          SendRow  (lnk_cLink *pLink, int Caps, mem_cMemRow * pRow, int Seq, int Try);
+	bool          SendConfigFrame(lnk_cLink *pLink, int Caps);
+
+	mem_cArena                 m_Arena;
+	CRITICAL_SECTION           m_Lock;
+	CONDITION_VARIABLE         m_Published;
+	int                        m_Ready;     /* rows below this are final */
+	bool                       m_bFailed;
+	mem_cMemRow * volatile   * m_pRows;     /* program, EEPROM then configuration rows */
+	int                        m_Rows;
+	int                        m_PMRows;
+	int                        m_EERows;
+	int                        m_CMRows;
+	int                        m_RowCount;  /* created so far */
+	const sDevice            * m_pDevice;
+	int                        m_RowSize;
+	tel_cSession             * m_pTelemetry;
+	mem_cMemImage            * m_pBase;
+};
+
 
-#endif
\ No newline at end of file
+#endif
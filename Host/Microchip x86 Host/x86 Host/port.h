@@ -0,0 +1,116 @@
+#ifndef _port_h
+#define _port_h
+
+/* The few Win32 types and calls the programmer uses outside serial.cpp,
+   for building on Linux with g++ */
+
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef int           HANDLE;
+typedef int           BOOL;
+typedef unsigned long DWORD;
+typedef long          LONG;
+
+typedef union
+{
+	long long QuadPart;
+} LARGE_INTEGER;
+
+typedef int           SOCKET;
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+typedef pthread_cond_t  CONDITION_VARIABLE;
+
+#define TRUE                 1
+#define FALSE                0
+#define MAX_PATH             260
+#define INVALID_HANDLE_VALUE (-1)
+#define INVALID_SOCKET       (-1)
+#define INFINITE             0xFFFFFFFF
+
+#define _tmain main
+#define _TCHAR char
+
+using std::min;
+using std::max;
+
+inline void InitializeCriticalSection(CRITICAL_SECTION * pLock) { pthread_mutex_init(pLock, NULL); }
+inline void DeleteCriticalSection    (CRITICAL_SECTION * pLock) { pthread_mutex_destroy(pLock); }
+inline void EnterCriticalSection     (CRITICAL_SECTION * pLock) { pthread_mutex_lock(pLock); }
+inline void LeaveCriticalSection     (CRITICAL_SECTION * pLock) { pthread_mutex_unlock(pLock); }
+
+inline void InitializeConditionVariable(CONDITION_VARIABLE * pCondition)
+{
+	pthread_condattr_t Attr;
+
+	pthread_condattr_init(&Attr);
+	pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+	pthread_cond_init(pCondition, &Attr);
+	pthread_condattr_destroy(&Attr);
+}
+
+inline void WakeAllConditionVariable(CONDITION_VARIABLE * pCondition) { pthread_cond_broadcast(pCondition); }
+
+inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE * pCondition, CRITICAL_SECTION * pLock, DWORD Milliseconds)
+{
+	struct timespec Until;
+
+	if(Milliseconds == INFINITE)
+	{
+		return (pthread_cond_wait(pCondition, pLock) == 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &Until);
+
+	Until.tv_sec  += Milliseconds / 1000;
+	Until.tv_nsec += (Milliseconds % 1000) * 1000000;
+
+	if(Until.tv_nsec >= 1000000000)
+	{
+		Until.tv_sec  += 1;
+		Until.tv_nsec -= 1000000000;
+	}
+
+	return (pthread_cond_timedwait(pCondition, pLock, &Until) == 0);
+}
+
+inline int closesocket(SOCKET Socket) { return close(Socket); }
+
+inline LONG InterlockedIncrement(volatile LONG * pValue) { return __sync_add_and_fetch(pValue, 1); }
+
+inline void Sleep(DWORD Milliseconds) { usleep(Milliseconds * 1000); }
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER * pFrequency)
+{
+	pFrequency->QuadPart = 1000000000LL;
+
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER * pCounter)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	pCounter->QuadPart = (long long)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+
+	return TRUE;
+}
+
+inline DWORD GetTickCount(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+
+	return (DWORD)(Now.tv_sec * 1000 + Now.tv_nsec / 1000000);
+}
+
+inline BOOL CreateDirectory(const char * pPath, void *) { return (mkdir(pPath, 0777) == 0); }
+
+#endif
@@ -0,0 +1,82 @@
+/******************************************************************************\
+ *
+ *  rle compresses formatted program rows for COMMAND_WRITE_PM_RLE. A row is
+ *  a series of 3 byte words (low, high, upper) and each control byte is
+ *  followed by the words it describes:
+ *
+ *    0nnnnnnn  n+1 words of 2 bytes, the upper byte is 0
+ *    10nnnnnn  n+1 words of 3 bytes
+ *    11nnnnnn  1 word of 3 bytes, repeated n+1 times
+ *
+ *  Most instructions have an upper byte of 0, and padding and NOP fills
+ *  become repeats.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+
+/******************************************************************************/
+static int RunLength(const char * pData, int Word, int Words)
+{
+	/* Number of identical words starting at Word, up to what one control byte
+	   can repeat */
+	int Run = 1;
+
+	while((Word + Run < Words) && (Run < 64) && (memcmp(pData + Word * 3, pData + (Word + Run) * 3, 3) == 0))
+	{
+		Run++;
+	}
+
+	return Run;
+}
+/******************************************************************************/
+int rle_Encode(const char * pData, int Words, char * pBuffer)
+{
+	int Size = 0;
+	int Word = 0;
+
+	while(Word < Words)
+	{
+		int Run = RunLength(pData, Word, Words);
+
+		if(Run > 1)
+		{
+			pBuffer[Size++] = (char)(0xC0 | (Run - 1));
+
+			memcpy(pBuffer + Size, pData + Word * 3, 3);
+
+			Size += 3;
+			Word += Run;
+		}
+		else
+		{
+			/* Literal words up to the next repeat or change of upper byte */
+			bool bUpper = (pData[Word * 3 + 2] != 0);
+			int  Max    = bUpper ? 64 : 128;
+			int  Count  = 1;
+
+			while((Word + Count < Words) &&
+				  (Count < Max) &&
+				  ((pData[(Word + Count) * 3 + 2] != 0) == bUpper) &&
+				  (RunLength(pData, Word + Count, Words) == 1))
+			{
+				Count++;
+			}
+
+			pBuffer[Size++] = (char)(bUpper ? (0x80 | (Count - 1)) : (Count - 1));
+
+			for(; Count != 0; Count--, Word++)
+			{
+				pBuffer[Size++] = pData[Word * 3];
+				pBuffer[Size++] = pData[Word * 3 + 1];
+
+				if(bUpper == TRUE)
+				{
+					pBuffer[Size++] = pData[Word * 3 + 2];
+				}
+			}
+		}
+	}
+
+	return Size;
+}
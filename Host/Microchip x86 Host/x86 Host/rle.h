@@ -0,0 +1,9 @@
+#ifndef _rle_h
+#define _rle_h
+
+/* Worst case encoded size of a program row, one control byte per word */
+#define RLE_MAX_SIZE(Words) ((Words) * 4)
+
+int rle_Encode(const char * pData, int Words, char * pBuffer);
+
+#endif
@@ -0,0 +1,454 @@
+/******************************************************************************\
+ *
+ *  serial is the port under lnk_cSerial. On Windows it is a COM port driven
+ *  through the Win32 comm API; elsewhere it is a tty driven through termios2,
+ *  which takes arbitrary baud rates, with reads that block in poll() until
+ *  data arrives or the timeout runs out.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <asm/termbits.h>
+#endif
+
+
+#ifdef _WIN32
+/******************************************************************************/
+BOOL WriteCommBlock(HANDLE * pComDev, const lnk_sBuffer *pBuffers, int Count)
+{
+	/* Win32 has no gather write for comm ports, so small lists are copied
+	   together to go out in one WriteFile. The port is overlapped, so a
+	   pending write is waited out before Buffer and osWrite go away */
+	char       Buffer[BUFFER_SIZE];
+	int        Size         = 0;
+	DWORD      BytesWritten = 0;
+	OVERLAPPED osWrite      = {0,0,0};
+
+	for(int Block = 0; Block < Count; Block++)
+	{
+		if(Size + pBuffers[Block].Size > (int)sizeof(Buffer))
+		{
+			Size = -1;
+			break;
+		}
+
+		memcpy(Buffer + Size, pBuffers[Block].pData, pBuffers[Block].Size);
+		Size += pBuffers[Block].Size;
+	}
+
+	if(Size < 0)
+	{
+		for(int Block = 0; Block < Count; Block++)
+		{
+			if(WriteCommBlock(pComDev, &pBuffers[Block], 1) != TRUE)
+			{
+				return (FALSE);
+			}
+		}
+
+		return (TRUE);
+	}
+
+	if(WriteFile(*pComDev,Buffer,Size,&BytesWritten,&osWrite) == FALSE)
+	{
+		if(GetLastError() != ERROR_IO_PENDING)
+		{
+			return (FALSE);
+		}
+
+		if(GetOverlappedResult(*pComDev, &osWrite, &BytesWritten, TRUE) == FALSE)
+		{
+			return (FALSE);
+		}
+	}
+
+	return (BytesWritten == (DWORD)Size) ? TRUE : FALSE;
+}
+/******************************************************************************/
+int ReadCommBlock(HANDLE *pComDev, char * pBuffer, int MaxLength, int Timeout)
+{
+	DWORD      Length     = 0;
+	COMSTAT    ComStat    = {0};
+	DWORD      ErrorFlags = 0;
+	OVERLAPPED osRead     = {0,0,0};
+	DWORD      Start      = GetTickCount();
+
+	/* only try to read number of bytes in queue, polling until some arrive */
+	for(;;)
+	{
+		ClearCommError(*pComDev, &ErrorFlags, &ComStat);
+
+		if((ComStat.cbInQue > 0) || ((int)(GetTickCount() - Start) >= Timeout))
+		{
+			break;
+		}
+
+		Sleep(1);
+	}
+
+	Length = min((DWORD)MaxLength, ComStat.cbInQue);
+   
+	if(Length > 0)
+	{
+		if((ReadFile(*pComDev, pBuffer, Length, &Length, &osRead) == FALSE) &&
+		   ((GetLastError() != ERROR_IO_PENDING) ||
+		    (GetOverlappedResult(*pComDev, &osRead, &Length, TRUE) == FALSE)))
+		{
+			Length = 0 ;
+
+			ClearCommError(*pComDev, &ErrorFlags, &ComStat);
+
+			assert(ErrorFlags == 0);
+		}
+	}
+
+	return (Length);
+}
+/******************************************************************************/
+HANDLE OpenConnection(HANDLE * pComDev, char * pPortName, char * pBaudRate)
+{
+	int BaudRate;
+	COMMTIMEOUTS CommTimeOuts;
+   DCB          Dcb;
+
+   sscanf(pBaudRate, "%d", &BaudRate);
+
+	*pComDev = CreateFile(pPortName,
+								  GENERIC_READ | GENERIC_WRITE,
+								  0,
+								  NULL,
+								  OPEN_EXISTING,
+								  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+								  NULL);
+	  
+	if(*pComDev == INVALID_HANDLE_VALUE)
+	{
+		return (*pComDev);
+	}
+
+	/* get any early notifications */
+	SetCommMask(*pComDev, EV_RXCHAR);
+
+	/* setup device buffers */
+	SetupComm(*pComDev, 10000, 10000);
+
+	/* purge any information in the buffer */
+	PurgeComm(*pComDev,  PURGE_TXABORT |
+								PURGE_RXABORT |
+								PURGE_TXCLEAR |
+								PURGE_RXCLEAR);
+
+	/* set up for overlapped I/O */
+	CommTimeOuts.ReadIntervalTimeout         = MAXDWORD;
+	CommTimeOuts.ReadTotalTimeoutMultiplier  = 0;
+	CommTimeOuts.ReadTotalTimeoutConstant    = 0;
+	CommTimeOuts.WriteTotalTimeoutMultiplier = 2*CBR_9600/BaudRate;
+	CommTimeOuts.WriteTotalTimeoutConstant   = 0 ;
+
+	BOOL bTimeouts = SetCommTimeouts(*pComDev, &CommTimeOuts);
+	assert(bTimeouts == TRUE);
+
+
+	Dcb.DCBlength = sizeof(DCB);
+
+	BOOL bGetState = GetCommState(*pComDev, &Dcb);
+	assert(bGetState == TRUE);
+
+	Dcb.BaudRate     = BaudRate;
+	Dcb.ByteSize     = BYTESIZE;
+	Dcb.Parity       = PARITY;
+	Dcb.StopBits     = STOPBITS;
+	Dcb.fOutxDsrFlow = FALSE;
+	Dcb.fDtrControl  = DTR_CONTROL_DISABLE;
+	Dcb.fOutxCtsFlow = FALSE ;
+	Dcb.fRtsControl  = RTS_CONTROL_DISABLE;
+	Dcb.fInX         = FALSE;
+	Dcb.fOutX        = FALSE;
+	//Dcb.XonChar      = ASCII_XON ;
+	//Dcb.XoffChar     = ASCII_XOFF ;
+	Dcb.XonLim       = 0x800;
+	Dcb.XoffLim      = 0x200;
+	Dcb.fBinary      = TRUE ;
+	Dcb.fParity      = TRUE ;
+
+	BOOL bSetState = SetCommState(*pComDev, &Dcb);
+	assert(bSetState == TRUE);
+
+	return (*pComDev);
+}
+/******************************************************************************/
+BOOL SetFlowControl(HANDLE * pComDev, bool bEnable)
+{
+	/* CTS flow control lets the bootloader pause us while the CPU is stalled
+	   erasing or writing flash */
+	DCB Dcb;
+
+	Dcb.DCBlength = sizeof(DCB);
+
+	if(GetCommState(*pComDev, &Dcb) != TRUE)
+	{
+		return (FALSE);
+	}
+
+	Dcb.fOutxCtsFlow = bEnable;
+
+	return (SetCommState(*pComDev, &Dcb));
+}
+/******************************************************************************/
+BOOL SetBaudRate(HANDLE * pComDev, int BaudRate)
+{
+	COMMTIMEOUTS CommTimeOuts;
+	DCB          Dcb;
+
+	Dcb.DCBlength = sizeof(DCB);
+
+	if(GetCommState(*pComDev, &Dcb) != TRUE)
+	{
+		return (FALSE);
+	}
+
+	Dcb.BaudRate = BaudRate;
+
+	if(SetCommState(*pComDev, &Dcb) != TRUE)
+	{
+		return (FALSE);
+	}
+
+	if(GetCommTimeouts(*pComDev, &CommTimeOuts) == TRUE)
+	{
+		CommTimeOuts.WriteTotalTimeoutMultiplier = 2*CBR_9600/BaudRate;
+
+		SetCommTimeouts(*pComDev, &CommTimeOuts);
+	}
+
+	return (TRUE);
+}
+/******************************************************************************/
+int GetBaudRate(HANDLE * pComDev)
+{
+	DCB Dcb;
+
+	Dcb.DCBlength = sizeof(DCB);
+
+	if(GetCommState(*pComDev, &Dcb) != TRUE)
+	{
+		return (0);
+	}
+
+	return ((int)Dcb.BaudRate);
+}
+/******************************************************************************/
+void PurgeConnection(HANDLE * pComDev)
+{
+	PurgeComm(*pComDev, PURGE_RXABORT | PURGE_RXCLEAR);
+}
+/******************************************************************************/
+BOOL CloseConnection(HANDLE * pComDev)
+{
+	/* purge any outstanding reads/writes and close device handle */
+	PurgeComm(*pComDev,  PURGE_TXABORT |
+								PURGE_RXABORT |
+								PURGE_TXCLEAR |
+								PURGE_RXCLEAR);
+
+	return(CloseHandle(*pComDev));
+}
+#else
+/******************************************************************************/
+BOOL WriteCommBlock(HANDLE * pComDev, const lnk_sBuffer *pBuffers, int Count)
+{
+	struct iovec Blocks[LNK_MAX_BUFFERS];
+	struct iovec * pBlock = Blocks;
+	ssize_t        Written;
+
+	for(int Block = 0; Block < Count; Block++)
+	{
+		Blocks[Block].iov_base = (void *)pBuffers[Block].pData;
+		Blocks[Block].iov_len  = pBuffers[Block].Size;
+	}
+
+	/* the port is blocking for writes, so writev() only returns early when
+	   interrupted by a signal */
+	while(Count > 0)
+	{
+		Written = writev(*pComDev, pBlock, Count);
+
+		if(Written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return (FALSE);
+		}
+
+		while((Count > 0) && (Written >= (ssize_t)pBlock->iov_len))
+		{
+			Written -= pBlock->iov_len;
+			pBlock++;
+			Count--;
+		}
+
+		if(Count > 0)
+		{
+			pBlock->iov_base  = (char *)pBlock->iov_base + Written;
+			pBlock->iov_len  -= Written;
+		}
+	}
+
+	return (TRUE);
+}
+/******************************************************************************/
+int ReadCommBlock(HANDLE *pComDev, char * pBuffer, int MaxLength, int Timeout)
+{
+	struct pollfd Poll;
+	int           Length;
+
+	Poll.fd      = *pComDev;
+	Poll.events  = POLLIN;
+	Poll.revents = 0;
+
+	/* sleep in the kernel until a byte arrives rather than polling the
+	   queue every millisecond */
+	if(poll(&Poll, 1, (Timeout > 0) ? Timeout : 0) <= 0)
+	{
+		return (0);
+	}
+
+	Length = read(*pComDev, pBuffer, MaxLength);
+
+	return ((Length > 0) ? Length : 0);
+}
+/******************************************************************************/
+static BOOL GetTermios(HANDLE * pComDev, struct termios2 * pTio)
+{
+	return (ioctl(*pComDev, TCGETS2, pTio) == 0);
+}
+/******************************************************************************/
+static BOOL SetTermios(HANDLE * pComDev, struct termios2 * pTio)
+{
+	/* wait for queued output to go at the old settings before switching */
+	return (ioctl(*pComDev, TCSETSW2, pTio) == 0);
+}
+/******************************************************************************/
+HANDLE OpenConnection(HANDLE * pComDev, char * pPortName, char * pBaudRate)
+{
+	int             BaudRate;
+	struct termios2 Tio;
+
+	sscanf(pBaudRate, "%d", &BaudRate);
+
+	/* O_NONBLOCK so a modem port with no carrier doesn't hang the open */
+	*pComDev = open(pPortName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if(*pComDev == INVALID_HANDLE_VALUE)
+	{
+		return (*pComDev);
+	}
+
+	fcntl(*pComDev, F_SETFL, fcntl(*pComDev, F_GETFL) & ~O_NONBLOCK);
+
+	if(GetTermios(pComDev, &Tio) != TRUE)
+	{
+		close(*pComDev);
+
+		*pComDev = INVALID_HANDLE_VALUE;
+
+		return (*pComDev);
+	}
+
+	/* raw 8-N-1, no flow control, no echo or line editing */
+	Tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+	Tio.c_oflag &= ~OPOST;
+	Tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	Tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD);
+	Tio.c_cflag |= CS8 | CREAD | CLOCAL | BOTHER;
+
+	Tio.c_cc[VMIN]  = 0;
+	Tio.c_cc[VTIME] = 0;
+
+	/* BOTHER takes the rate as a number, so any rate the UART can make works */
+	Tio.c_ispeed = BaudRate;
+	Tio.c_ospeed = BaudRate;
+
+	BOOL bSetState = SetTermios(pComDev, &Tio);
+	assert(bSetState == TRUE);
+
+	/* purge any information in the buffer */
+	ioctl(*pComDev, TCFLSH, TCIOFLUSH);
+
+	return (*pComDev);
+}
+/******************************************************************************/
+BOOL SetFlowControl(HANDLE * pComDev, bool bEnable)
+{
+	/* CTS flow control lets the bootloader pause us while the CPU is stalled
+	   erasing or writing flash */
+	struct termios2 Tio;
+
+	if(GetTermios(pComDev, &Tio) != TRUE)
+	{
+		return (FALSE);
+	}
+
+	if(bEnable)
+	{
+		Tio.c_cflag |= CRTSCTS;
+	}
+	else
+	{
+		Tio.c_cflag &= ~CRTSCTS;
+	}
+
+	return (SetTermios(pComDev, &Tio));
+}
+/******************************************************************************/
+BOOL SetBaudRate(HANDLE * pComDev, int BaudRate)
+{
+	struct termios2 Tio;
+
+	if(GetTermios(pComDev, &Tio) != TRUE)
+	{
+		return (FALSE);
+	}
+
+	Tio.c_cflag &= ~CBAUD;
+	Tio.c_cflag |= BOTHER;
+	Tio.c_ispeed = BaudRate;
+	Tio.c_ospeed = BaudRate;
+
+	return (SetTermios(pComDev, &Tio));
+}
+/******************************************************************************/
+int GetBaudRate(HANDLE * pComDev)
+{
+	struct termios2 Tio;
+
+	if(GetTermios(pComDev, &Tio) != TRUE)
+	{
+		return (0);
+	}
+
+	return ((int)Tio.c_ospeed);
+}
+/******************************************************************************/
+void PurgeConnection(HANDLE * pComDev)
+{
+	ioctl(*pComDev, TCFLSH, TCIFLUSH);
+}
+/******************************************************************************/
+BOOL CloseConnection(HANDLE * pComDev)
+{
+	/* purge any outstanding reads/writes and close device handle */
+	ioctl(*pComDev, TCFLSH, TCIOFLUSH);
+
+	return (close(*pComDev) == 0);
+}
+#endif
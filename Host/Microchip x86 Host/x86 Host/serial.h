@@ -0,0 +1,13 @@
+#ifndef _serial_h
+#define _serial_h
+
+HANDLE OpenConnection (HANDLE *pComDev,  char *pPortName, char *pBaudRate);
+BOOL   WriteCommBlock (HANDLE *pComdDev, const lnk_sBuffer *pBuffers, int Count);
+int    ReadCommBlock  (HANDLE *pComdDev, char *pBuffer,   int MaxLength, int Timeout);
+BOOL   CloseConnection(HANDLE *pComdDev);
+BOOL   SetFlowControl (HANDLE *pComdDev, bool bEnable);
+BOOL   SetBaudRate    (HANDLE *pComdDev, int BaudRate);
+int    GetBaudRate    (HANDLE *pComdDev);
+void   PurgeConnection(HANDLE *pComdDev);
+
+#endif
@@ -7,19 +7,44 @@
 
 #define WIN32_LEAN_AND_MEAN		// Exclude rarely-used stuff from Windows headers
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
 // TODO: reference additional headers your program requires here
 
 #include <stdlib.h>
+#ifdef _WIN32
 #include <io.h>
+#endif
 #include <ctype.h>
+#ifdef _WIN32
 #include <dos.h>
+#endif
 #include <time.h>
 #include <math.h>
+#ifdef _WIN32
+#define _WIN32_WINNT 0x0600				// Condition variables need Vista
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <process.h>
+#else
+#include "port.h"
+#endif
 #include <assert.h>
+#include <new>
 #include "16-Bit Flash Programmer.h"
 #include "cmd.h"
-#include "mem.h"
\ No newline at end of file
+#include "lnk.h"
+#include "tel.h"
+#include "bch.h"
+#include "serial.h"
+#include "mem.h"
+#include "hex.h"
+#include "xfw.h"
+#include "crc.h"
+#include "rle.h"
+#include "frm.h"
+#include "emu.h"
+#include "dmp.h"
\ No newline at end of file
@@ -0,0 +1,408 @@
+/******************************************************************************\
+ *
+ *  tel is the telemetry of a programming session. The protocol code tells
+ *  a tel_cSession when each phase begins and ends and when each row is
+ *  sent and answered; the session stamps the event with the time since it
+ *  began and the bytes on the link so far, and hands it to every sink:
+ *
+ *    tel_Progress     a dot per row sent or read, the console progress bar
+ *    tel_cLog::Write  one line per event to a file, JSON or CSV (-l)
+ *    bch_Collect      the figures the benchmark holds to its baselines
+ *
+ *  Nothing is printed on the transfer path but by a sink, so with -q,
+ *  which installs no console sink and silences tel_Print, a session does
+ *  no console I/O at all. Errors are still printed.
+ *
+ *  The parse and format phases are told by the loader thread while the
+ *  rows are being sent, so a sink may be called from either thread.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+#include <stdarg.h>
+
+static bool bQuietMode = FALSE;
+
+static const char * PhaseNames[TEL_PHASES] = {"id", "parse", "format", "preserve", "program", "reset", "verify", "dump"};
+static const char * EventNames[]           = {"begin", "end", "row_sent", "row_acked", "row_nacked", "unchanged", "summary", "row_read"};
+
+/******************************************************************************/
+static const char * AckName(int Ack)
+{
+	/* What the target did with an acknowledged page, for the log */
+	switch(Ack)
+	{
+		case COMMAND_ACK:   return "written";
+		case ACK_UNCHANGED: return "unchanged";
+		case ACK_NO_ERASE:  return "unerased";
+	}
+
+	return "";
+}
+/******************************************************************************/
+static void PutText(FILE * pFile, const char * pText, bool bCsv)
+{
+	/* A port name as a JSON string, quotes included, or as a CSV field,
+	   quoted only if it has to be. Windows names such as \\.\COM10 are
+	   full of backslashes. */
+	bool bQuote = (bCsv != TRUE) || (strpbrk(pText, ",\"\r\n") != NULL);
+
+	if(bQuote == TRUE)
+	{
+		fputc('"', pFile);
+	}
+
+	for(; *pText != '\0'; pText++)
+	{
+		if(bCsv == TRUE)
+		{
+			if(*pText == '"')
+			{
+				fputc('"', pFile);
+			}
+
+			fputc(*pText, pFile);
+		}
+		else if((*pText == '"') || (*pText == '\\'))
+		{
+			fputc('\\', pFile);
+			fputc(*pText, pFile);
+		}
+		else if((unsigned char)*pText < 0x20)
+		{
+			fprintf(pFile, "\\u%04x", (unsigned char)*pText);
+		}
+		else
+		{
+			fputc(*pText, pFile);
+		}
+	}
+
+	if(bQuote == TRUE)
+	{
+		fputc('"', pFile);
+	}
+}
+/******************************************************************************/
+void tel_SetQuiet(bool bQuiet)
+{
+	bQuietMode = bQuiet;
+}
+/******************************************************************************/
+void tel_Print(const char * pFormat, ...)
+{
+	va_list Args;
+
+	if(bQuietMode == TRUE)
+	{
+		return;
+	}
+
+	va_start(Args, pFormat);
+	vprintf(pFormat, Args);
+	va_end(Args);
+}
+/******************************************************************************/
+void tel_Progress(const tel_sEvent * pEvent, void *)
+{
+	if((pEvent->Event == EventRowSent) || (pEvent->Event == EventRowRead))
+	{
+		printf(".");
+	}
+}
+/******************************************************************************/
+tel_cSession::tel_cSession(lnk_cLink * pLink)
+: m_pLink(pLink),
+  m_pName(NULL),
+  m_SinkCount(0),
+  m_Rows(0),
+  m_Retries(0),
+  m_Unwritten(0),
+  m_Unerased(0)
+{
+	m_Start = bch_Now();
+
+	for(int Phase = 0; Phase < TEL_PHASES; Phase++)
+	{
+		m_PhaseStart[Phase] = 0;
+		m_PhaseUs[Phase]    = 0;
+	}
+}
+/******************************************************************************/
+void tel_cSession::AddSink(tel_fSink pSink, void * pContext)
+{
+	assert(m_SinkCount < TEL_MAX_SINKS);
+
+	m_Sinks[m_SinkCount].pSink    = pSink;
+	m_Sinks[m_SinkCount].pContext = pContext;
+	m_SinkCount++;
+}
+/******************************************************************************/
+void tel_cSession::Emit(tel_sEvent * pEvent)
+{
+	pEvent->TimeUs    = bch_Now() - m_Start;
+	pEvent->BytesOut  = m_pLink->BytesOut();
+	pEvent->BytesIn   = m_pLink->BytesIn();
+	pEvent->Rows      = m_Rows;
+	pEvent->Retries   = m_Retries;
+	pEvent->Unwritten = m_Unwritten;
+	pEvent->Unerased  = m_Unerased;
+	pEvent->pName     = m_pName;
+
+	for(int Sink = 0; Sink < m_SinkCount; Sink++)
+	{
+		m_Sinks[Sink].pSink(pEvent, m_Sinks[Sink].pContext);
+	}
+}
+/******************************************************************************/
+static void Clear(tel_sEvent * pEvent, eEvent Event)
+{
+	memset(pEvent, 0, sizeof(*pEvent));
+
+	pEvent->Event = Event;
+	pEvent->Seq   = -1;
+}
+/******************************************************************************/
+void tel_cSession::Begin(ePhase Phase)
+{
+	tel_sEvent Event;
+
+	m_PhaseStart[Phase] = bch_Now();
+
+	Clear(&Event, EventPhaseBegin);
+	Event.Phase = Phase;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::End(ePhase Phase)
+{
+	tel_sEvent Event;
+
+	m_PhaseUs[Phase] += bch_Now() - m_PhaseStart[Phase];
+
+	Clear(&Event, EventPhaseEnd);
+	Event.Phase      = Phase;
+	Event.DurationUs = m_PhaseUs[Phase];
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::RowSent(unsigned int Address, int Seq, int Try, int Size)
+{
+	tel_sEvent Event;
+
+	if(Try > 0)
+	{
+		m_Retries++;
+	}
+
+	Clear(&Event, EventRowSent);
+	Event.Phase   = PhaseProgram;
+	Event.Address = Address;
+	Event.Seq     = Seq;
+	Event.Try     = Try;
+	Event.Size    = Size;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::RowAcked(unsigned int Address, int Seq, double LatencyUs, int Ack)
+{
+	tel_sEvent Event;
+
+	m_Rows++;
+
+	if(Ack == ACK_UNCHANGED)
+	{
+		m_Unwritten++;
+	}
+	else if(Ack == ACK_NO_ERASE)
+	{
+		m_Unerased++;
+	}
+
+	Clear(&Event, EventRowAcked);
+	Event.Phase      = PhaseProgram;
+	Event.Address    = Address;
+	Event.Seq        = Seq;
+	Event.DurationUs = LatencyUs;
+	Event.Ack        = Ack;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::RowNacked(unsigned int Address, int Seq)
+{
+	tel_sEvent Event;
+
+	Clear(&Event, EventRowNacked);
+	Event.Phase   = PhaseProgram;
+	Event.Address = Address;
+	Event.Seq     = Seq;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::Unchanged(int Rows)
+{
+	tel_sEvent Event;
+
+	Clear(&Event, EventUnchanged);
+	Event.Phase = PhaseProgram;
+	Event.Size  = Rows;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::RowRead(unsigned int Address, int Seq, int Tries, int Size)
+{
+	/* A row of a dump has come back, after Tries resends of its request */
+	tel_sEvent Event;
+
+	m_Rows++;
+	m_Retries += Tries;
+
+	Clear(&Event, EventRowRead);
+	Event.Phase   = PhaseDump;
+	Event.Address = Address;
+	Event.Seq     = Seq;
+	Event.Try     = Tries;
+	Event.Size    = Size;
+	Emit(&Event);
+}
+/******************************************************************************/
+void tel_cSession::Finish(bool bDone)
+{
+	tel_sEvent Event;
+
+	Clear(&Event, EventSummary);
+	Event.DurationUs = bch_Now() - m_Start;
+	Event.bDone      = bDone;
+	Event.pPhaseUs   = m_PhaseUs;
+	Emit(&Event);
+}
+/******************************************************************************/
+tel_cLog::tel_cLog()
+: m_pFile(NULL),
+  m_bCsv(FALSE)
+{
+	InitializeCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+tel_cLog::~tel_cLog()
+{
+	if(m_pFile != NULL)
+	{
+		fclose(m_pFile);
+	}
+
+	DeleteCriticalSection(&m_Lock);
+}
+/******************************************************************************/
+bool tel_cLog::Open(const char * pFileName)
+{
+	/* CSV for a .csv file, JSON lines otherwise. The file is appended to,
+	   so one log can collect every session of a station. */
+	const char * pExtension = strrchr(pFileName, '.');
+
+	if((m_pFile = fopen(pFileName, "a")) == NULL)
+	{
+		return FALSE;
+	}
+
+	m_bCsv = (pExtension != NULL) && (strcmp(pExtension, ".csv") == 0);
+
+	/* An appending stream may not be at the end until it is written to */
+	fseek(m_pFile, 0, SEEK_END);
+
+	if((m_bCsv == TRUE) && (ftell(m_pFile) == 0))
+	{
+		fprintf(m_pFile, "time_us,event,phase,address,seq,try,size,duration_us,bytes_out,bytes_in,rows,retries,port,ack\n");
+	}
+
+	return TRUE;
+}
+/******************************************************************************/
+void tel_cLog::Write(const tel_sEvent * pEvent, void * pContext)
+{
+	/* Lines go out buffered and are flushed at the end of each phase, so a
+	   dashboard following the file sees it move without a write per row.
+	   Sessions on several ports may share one log. */
+	tel_cLog   * pLog   = (tel_cLog *)pContext;
+	FILE       * pFile  = pLog->m_pFile;
+	const char * pName  = EventNames[pEvent->Event];
+	const char * pPhase = PhaseNames[pEvent->Phase];
+	const char * pPort  = (pEvent->pName != NULL) ? pEvent->pName : "";
+
+	EnterCriticalSection(&pLog->m_Lock);
+
+	if(pLog->m_bCsv == TRUE)
+	{
+		fprintf(pFile, "%.0f,%s,%s,0x%06x,%d,%d,%d,%.0f,%d,%d,%d,%d,",
+		        pEvent->TimeUs, pName, (pEvent->Event == EventSummary) ? "" : pPhase,
+		        pEvent->Address, pEvent->Seq, pEvent->Try, pEvent->Size, pEvent->DurationUs,
+		        pEvent->BytesOut, pEvent->BytesIn, pEvent->Rows, pEvent->Retries);
+		PutText(pFile, pPort, TRUE);
+		fprintf(pFile, ",%s\n", AckName(pEvent->Ack));
+	}
+	else
+	{
+		fprintf(pFile, "{\"time_us\":%.0f,\"event\":\"%s\"", pEvent->TimeUs, pName);
+
+		if(pEvent->pName != NULL)
+		{
+			fprintf(pFile, ",\"port\":");
+			PutText(pFile, pPort, FALSE);
+		}
+
+		switch(pEvent->Event)
+		{
+			case EventPhaseBegin:
+				fprintf(pFile, ",\"phase\":\"%s\"", pPhase);
+				break;
+
+			case EventPhaseEnd:
+				fprintf(pFile, ",\"phase\":\"%s\",\"duration_us\":%.0f", pPhase, pEvent->DurationUs);
+				break;
+
+			case EventRowSent:
+			case EventRowRead:
+				fprintf(pFile, ",\"address\":%u,\"seq\":%d,\"try\":%d,\"size\":%d", pEvent->Address, pEvent->Seq, pEvent->Try, pEvent->Size);
+				break;
+
+			case EventRowAcked:
+				fprintf(pFile, ",\"address\":%u,\"seq\":%d,\"latency_us\":%.0f", pEvent->Address, pEvent->Seq, pEvent->DurationUs);
+
+				if(pEvent->Ack != COMMAND_ACK)
+				{
+					fprintf(pFile, ",\"ack\":\"%s\"", AckName(pEvent->Ack));
+				}
+				break;
+
+			case EventRowNacked:
+				fprintf(pFile, ",\"address\":%u,\"seq\":%d", pEvent->Address, pEvent->Seq);
+				break;
+
+			case EventUnchanged:
+				fprintf(pFile, ",\"unchanged\":%d", pEvent->Size);
+				break;
+
+			case EventSummary:
+				fprintf(pFile, ",\"done\":%s,\"duration_us\":%.0f,\"bytes_per_s\":%.0f,\"phases_us\":{",
+				        (pEvent->bDone == TRUE) ? "true" : "false", pEvent->DurationUs,
+				        (pEvent->DurationUs > 0) ? pEvent->BytesOut * 1000000.0 / pEvent->DurationUs : 0.0);
+
+				for(int Phase = 0; Phase < TEL_PHASES; Phase++)
+				{
+					fprintf(pFile, "%s\"%s\":%.0f", (Phase == 0) ? "" : ",", PhaseNames[Phase], pEvent->pPhaseUs[Phase]);
+				}
+
+				fprintf(pFile, "},\"unwritten\":%d,\"unerased\":%d", pEvent->Unwritten, pEvent->Unerased);
+				break;
+		}
+
+		fprintf(pFile, ",\"bytes_out\":%d,\"bytes_in\":%d,\"rows\":%d,\"retries\":%d}\n",
+		        pEvent->BytesOut, pEvent->BytesIn, pEvent->Rows, pEvent->Retries);
+	}
+
+	if((pEvent->Event == EventPhaseEnd) || (pEvent->Event == EventSummary))
+	{
+		fflush(pFile);
+	}
+
+	LeaveCriticalSection(&pLog->m_Lock);
+}
@@ -0,0 +1,116 @@
+#ifndef _tel_h
+#define _tel_h
+
+#define TEL_MAX_SINKS 4
+
+enum ePhase
+{
+	PhaseId,       /* capabilities, baud rate and device ID */
+	PhaseParse,    /* hex file or cached image */
+	PhaseFormat,
+	PhasePreserve, /* reading the target's reset vector */
+	PhaseProgram,
+	PhaseReset,
+	PhaseVerify,   /* comparing CRCs with the target (-v) */
+	PhaseDump,     /* reading program memory into a file (-d) */
+	TEL_PHASES
+};
+
+enum eEvent
+{
+	EventPhaseBegin,
+	EventPhaseEnd,
+	EventRowSent,
+	EventRowAcked,
+	EventRowNacked,
+	EventUnchanged,
+	EventSummary,
+	EventRowRead
+};
+
+typedef struct
+{
+	eEvent         Event;
+	ePhase         Phase;
+	double         TimeUs;     /* since the session began */
+	unsigned int   Address;    /* of the row */
+	int            Seq;        /* of the row's frame, -1 if unframed */
+	int            Try;        /* 0 the first time a row is sent, or the resends a read took */
+	int            Size;       /* row bytes on the wire, or rows found unchanged */
+	double         DurationUs; /* acknowledgement latency, or phase time */
+	int            Ack;        /* COMMAND_ACK, or ACK_UNCHANGED or ACK_NO_ERASE for the work the target spared */
+	int            BytesOut;   /* on the link so far */
+	int            BytesIn;
+	int            Rows;       /* acknowledged, or read, so far */
+	int            Retries;
+	int            Unwritten;  /* pages the target found already holding their data */
+	int            Unerased;   /* pages the target wrote without erasing, being blank */
+	bool           bDone;      /* summary: the target was programmed */
+	const double * pPhaseUs;   /* summary: time in each phase */
+	const char   * pName;      /* of the session's port, or NULL */
+} tel_sEvent;
+
+typedef void (*tel_fSink)(const tel_sEvent * pEvent, void * pContext);
+
+class tel_cSession
+{
+public:
+	tel_cSession(lnk_cLink * pLink);
+
+	void AddSink  (tel_fSink pSink, void * pContext);
+	void SetName  (const char * pName) { m_pName = pName; }
+	void Begin    (ePhase Phase);
+	void End      (ePhase Phase);
+	void RowSent  (unsigned int Address, int Seq, int Try, int Size);
+	void RowAcked (unsigned int Address, int Seq, double LatencyUs, int Ack);
+	void RowNacked(unsigned int Address, int Seq);
+	void Unchanged(int Rows);
+	void RowRead  (unsigned int Address, int Seq, int Tries, int Size);
+	void Finish   (bool bDone);
+
+	int Unwritten(void) { return m_Unwritten; }
+	int Unerased (void) { return m_Unerased; }
+
+private:
+	void Emit(tel_sEvent * pEvent);
+
+	struct sSink
+	{
+		tel_fSink pSink;
+		void    * pContext;
+	};
+
+	lnk_cLink  * m_pLink;
+	const char * m_pName;
+	sSink        m_Sinks[TEL_MAX_SINKS];
+	int          m_SinkCount;
+	double       m_Start;
+	double       m_PhaseStart[TEL_PHASES];
+	double       m_PhaseUs[TEL_PHASES];
+	int          m_Rows;
+	int          m_Retries;
+	int          m_Unwritten;
+	int          m_Unerased;
+};
+
+class tel_cLog
+{
+public:
+	tel_cLog();
+	~tel_cLog();
+
+	bool Open(const char * pFileName);
+
+	static void Write(const tel_sEvent * pEvent, void * pContext);
+
+private:
+	CRITICAL_SECTION m_Lock;
+	FILE           * m_pFile;
+	bool             m_bCsv;
+};
+
+void tel_Progress(const tel_sEvent * pEvent, void * pContext);
+void tel_SetQuiet(bool bQuiet);
+void tel_Print   (const char * pFormat, ...);
+
+#endif
@@ -0,0 +1,233 @@
+/******************************************************************************\
+ *
+ *  xfw is a binary cache of a firmware image that has already been parsed
+ *  and formatted, so a repeat flash of the same hex file skips both steps.
+ *  Cache files are named after a hash of the hex file's contents and the
+ *  device, whose memories the rows are laid out to, and are read back with
+ *  a single fread.
+ *
+ *  All fields are little-endian:
+ *
+ *    header  magic       u32   XFW_MAGIC
+ *            version     u32   XFW_VERSION
+ *            device      u32   device ID, process ID in the upper half
+ *            source      u64   FNV-1a hash of the hex file
+ *            rows        u32   number of row records that follow
+ *
+ *    row     index       u32   row number in mem_cMemImage
+ *            size        u32   payload size in bytes
+ *            hash        u32   FNV-1a hash of the payload
+ *            payload           formatted row, as sent to the target
+ *
+ *  The preserved reset vector is device specific and is never cached; it is
+ *  patched into row 0 after loading.
+ *
+\******************************************************************************/
+#include "stdafx.h"
+
+
+#define FNV64_OFFSET 0xCBF29CE484222325ULL
+#define FNV64_PRIME  0x00000100000001B3ULL
+#define FNV32_OFFSET 0x811C9DC5
+#define FNV32_PRIME  0x01000193
+
+/******************************************************************************/
+static unsigned int Hash32(const char * pData, int Size)
+{
+	unsigned int Hash = FNV32_OFFSET;
+
+	for(int Count = 0; Count < Size; Count++)
+	{
+		Hash = (Hash ^ (unsigned char)pData[Count]) * FNV32_PRIME;
+	}
+
+	return Hash;
+}
+/******************************************************************************/
+static unsigned int DeviceKey(const sDevice * pDevice)
+{
+	return(pDevice->Id | (pDevice->ProcessId << 16));
+}
+/******************************************************************************/
+static void PutU32(FILE * pFile, unsigned int Value)
+{
+	unsigned char Bytes[4];
+
+	Bytes[0] = (Value)       & 0xFF;
+	Bytes[1] = (Value >> 8)  & 0xFF;
+	Bytes[2] = (Value >> 16) & 0xFF;
+	Bytes[3] = (Value >> 24) & 0xFF;
+
+	fwrite(Bytes, 1, 4, pFile);
+}
+/******************************************************************************/
+static unsigned int GetU32(const unsigned char * pBytes)
+{
+	return(pBytes[0] | (pBytes[1] << 8) | (pBytes[2] << 16) | ((unsigned int)pBytes[3] << 24));
+}
+/******************************************************************************/
+unsigned long long xfw_HashFile(const char * pFileName)
+{
+	unsigned long long Hash = FNV64_OFFSET;
+	unsigned char      Buffer[BUFFER_SIZE];
+	FILE             * pFile;
+	size_t             Size;
+
+	if((pFile = fopen(pFileName, "rb")) == NULL)
+	{
+		return 0;
+	}
+
+	while((Size = fread(Buffer, 1, sizeof(Buffer), pFile)) > 0)
+	{
+		for(size_t Count = 0; Count < Size; Count++)
+		{
+			Hash = (Hash ^ Buffer[Count]) * FNV64_PRIME;
+		}
+	}
+
+	fclose(pFile);
+
+	return Hash;
+}
+/******************************************************************************/
+void xfw_CachePath(char * pPath, const char * pCacheDir, unsigned long long SourceHash, const sDevice * pDevice)
+{
+	sprintf(pPath, "%s" PATH_SEPARATOR "%08x%08x-%s.xfw", pCacheDir, (unsigned int)(SourceHash >> 32), (unsigned int)SourceHash, pDevice->pName);
+}
+/******************************************************************************/
+bool xfw_Load(const char * pPath, unsigned long long SourceHash, const sDevice * pDevice, mem_cMemImage * pMemory)
+{
+	FILE          * pFile;
+	unsigned char * pImage;
+	long            Size;
+	bool            bValid;
+
+	if((pFile = fopen(pPath, "rb")) == NULL)
+	{
+		return FALSE;
+	}
+
+	fseek(pFile, 0, SEEK_END);
+	Size = ftell(pFile);
+	rewind(pFile);
+
+	pImage = (unsigned char *)malloc(Size + 1);
+	assert(pImage != NULL);
+
+	bValid = ((long)fread(pImage, 1, Size, pFile) == Size) && (Size >= 24);
+
+	fclose(pFile);
+
+	bValid = bValid &&
+			 (GetU32(pImage + 0)  == XFW_MAGIC) &&
+			 (GetU32(pImage + 4)  == XFW_VERSION) &&
+			 (GetU32(pImage + 8)  == DeviceKey(pDevice)) &&
+			 (GetU32(pImage + 12) == (unsigned int)SourceHash) &&
+			 (GetU32(pImage + 16) == (unsigned int)(SourceHash >> 32));
+
+	/* Check every row before touching the image, a bad cache is just a miss */
+	for(int Pass = 0; (Pass < 2) && (bValid == TRUE); Pass++)
+	{
+		unsigned char * pRecord = pImage + 24;
+		int             Rows    = GetU32(pImage + 20);
+
+		for(int Count = 0; (Count < Rows) && (bValid == TRUE); Count++)
+		{
+			int Row;
+			int RowSize;
+
+			if(pRecord + 12 > pImage + Size)
+			{
+				bValid = FALSE;
+				break;
+			}
+
+			Row     = GetU32(pRecord);
+			RowSize = GetU32(pRecord + 4);
+
+			if((Row < 0) || (Row >= pMemory->Rows()) ||
+			   (RowSize != pMemory->RowBytes(Row)) ||
+			   (pRecord + 12 + RowSize > pImage + Size) ||
+			   (Hash32((char *)pRecord + 12, RowSize) != GetU32(pRecord + 8)))
+			{
+				bValid = FALSE;
+				break;
+			}
+
+			if(Pass == 1)
+			{
+				pMemory->LoadRow(Row, (char *)pRecord + 12);
+			}
+
+			pRecord += 12 + RowSize;
+		}
+	}
+
+	free(pImage);
+
+	return bValid;
+}
+/******************************************************************************/
+bool xfw_Save(const char * pPath, unsigned long long SourceHash, const sDevice * pDevice, mem_cMemImage * pMemory)
+{
+	char   TempPath[MAX_PATH + 8];
+	FILE * pFile;
+	int    Rows = 0;
+	bool   bResult;
+
+	for(int Row = 0; Row < pMemory->Rows(); Row++)
+	{
+		if((pMemory->Row(Row) != NULL) && (pMemory->Row(Row)->IsEmpty() != TRUE))
+		{
+			Rows++;
+		}
+	}
+
+	/* Write to a temporary file and rename it, so a cache file is never seen
+	   half written */
+	sprintf(TempPath, "%s.tmp", pPath);
+
+	if((pFile = fopen(TempPath, "wb")) == NULL)
+	{
+		return FALSE;
+	}
+
+	PutU32(pFile, XFW_MAGIC);
+	PutU32(pFile, XFW_VERSION);
+	PutU32(pFile, DeviceKey(pDevice));
+	PutU32(pFile, (unsigned int)SourceHash);
+	PutU32(pFile, (unsigned int)(SourceHash >> 32));
+	PutU32(pFile, Rows);
+
+	for(int Row = 0; Row < pMemory->Rows(); Row++)
+	{
+		mem_cMemRow * pRow = pMemory->Row(Row);
+
+		if((pRow == NULL) || (pRow->IsEmpty() == TRUE))
+		{
+			continue;
+		}
+
+		PutU32(pFile, Row);
+		PutU32(pFile, pRow->Size());
+		PutU32(pFile, Hash32(pRow->Buffer(), pRow->Size()));
+		fwrite(pRow->Buffer(), 1, pRow->Size(), pFile);
+	}
+
+	bResult = (ferror(pFile) == 0);
+	bResult = (fclose(pFile) == 0) && bResult;
+
+	if(bResult == TRUE)
+	{
+		remove(pPath);
+		bResult = (rename(TempPath, pPath) == 0);
+	}
+
+	if(bResult != TRUE)
+	{
+		remove(TempPath);
+	}
+
+	return bResult;
+}
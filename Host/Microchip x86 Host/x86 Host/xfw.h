@@ -0,0 +1,12 @@
+#ifndef _xfw_h
+#define _xfw_h
+
+#define XFW_MAGIC   0x31574658 /* "XFW1" */
+#define XFW_VERSION 2
+
+unsigned long long xfw_HashFile(const char * pFileName);
+void               xfw_CachePath(char * pPath, const char * pCacheDir, unsigned long long SourceHash, const sDevice * pDevice);
+bool               xfw_Load(const char * pPath, unsigned long long SourceHash, const sDevice * pDevice, mem_cMemImage * pMemory);
+bool               xfw_Save(const char * pPath, unsigned long long SourceHash, const sDevice * pDevice, mem_cMemImage * pMemory);
+
+#endif
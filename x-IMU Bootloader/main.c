@@ -27,6 +27,7 @@ _FWDT(FWDTEN_OFF)			// Watchdog Timer: Disabled
 // Definitions
 
 #define bluetoothEnablePin _LATA9
+#define ftdiCtsPin         _LATC0                                   // high holds off FTDI transmission
 
 #define FCY   			    39998371               
 #define BRGVAL              21
@@ -38,10 +39,38 @@ _FWDT(FWDTEN_OFF)			// Watchdog Timer: Disabled
 #define COMMAND_WRITE_CM    0x07
 #define COMMAND_RESET       0x08
 #define COMMAND_READ_ID     0x09
+#define COMMAND_READ_CAPS   0x0A
+#define COMMAND_ERASE_PM    0x0B
+#define COMMAND_READ_CRC    0x0C
+#define COMMAND_SET_BAUD    0x0D
+#define COMMAND_WRITE_PM_RLE 0x0E
+#define COMMAND_HELLO       0x0F
+#define COMMAND_CRC_RANGE   0x10
+#define COMMAND_READ_STATS  0x11
+#define COMMAND_FRAME       ((char)0xA5)                            // start of frame, protocol v2
+#define ACK_UNCHANGED       0x02                                    // page already held the data, nothing written
+#define ACK_NO_ERASE        0x03                                    // page was blank, written without an erase
+#define HELLO_ACK_PATH      0x01                                    // HELLO option: acknowledge pages with the above
+
+#define BOOTLOADER_VERSION  0x18                                    // major.minor in high and low nibble
+#define CAPS_ERASE_PM       0x01
+#define CAPS_READ_CRC       0x02
+#define CAPS_FLOW_CONTROL   0x04
+#define CAPS_SET_BAUD       0x08
+#define CAPS_WRITE_PM_RLE   0x10
+#define CAPS_FRAMED         0x20
+#define CAPS_CRC_RANGE      0x40
+#define CAPS_READ_STATS     0x80
+#define CAPS                (CAPS_ERASE_PM | CAPS_READ_CRC | CAPS_FLOW_CONTROL | CAPS_SET_BAUD | CAPS_WRITE_PM_RLE | CAPS_FRAMED | CAPS_CRC_RANGE | CAPS_READ_STATS)
 
 #define PM_ROW_SIZE         64 * 8
+#define WRITE_ROW_SIZE      64                                      // instructions programmed at once, 8 to a page
 #define CM_ROW_SIZE         8
 #define CONFIG_WORD_SIZE    1
+#define FRAME_SIZE          (4 + PM_ROW_SIZE*3)                     // largest payload, a raw COMMAND_WRITE_PM
+#define RX_RING_SIZE        1024                                    // words, all of DMA RAM, a power of 2
+#define RX_EMPTY            0xFFFF                                  // slot not yet written, no UART read is this
+#define DMA_REQ_U1RX        0x000B                                  // UART1 receiver IRQ number
 
 #define PM_ROW_ERASE 		0x4042
 #define PM_ROW_WRITE 		0x4001
@@ -64,7 +93,35 @@ typedef union tuReg32 {
 //---------------------------------------------------------------------------------------------------
 // Variable declaration and definitions
 
-char Buffer[PM_ROW_SIZE*3 + 1];
+char Buffer[CM_ROW_SIZE*3];                                         // configuration words, written at reset
+char RxBuffer[PM_ROW_SIZE*3];                                       // page being programmed
+
+volatile unsigned int RxRing[RX_RING_SIZE] __attribute__((space(dma))); // filled by DMA0 from U1RXREG, oldest first
+volatile UWord16 RxHead = 0;                                        // next slot to read
+char RxOverrun = 0;                                                 // set when DMA0 lapped the reader
+
+char Frame[FRAME_SIZE];                                             // payload of the last frame, then its reply
+UWord16 FrameIndex;                                                 // next argument byte in Frame
+UWord16 FrameSize;
+UWord16 ReplySize;
+char FrameSeq;
+char Framed = 0;                                                    // once set, commands only arrive in frames
+char FrameUnderrun;                                                 // the command read past the end of its frame
+char AckPath = 0;                                                   // set by HELLO_ACK_PATH
+
+UWord16 StatsPages = 0;                                             // pages written since reset
+UWord16 StatsMax = 0;                                               // Timer1 ticks of the slowest page write
+UWord32 StatsTotal = 0;                                             // Timer1 ticks of all page writes
+UWord16 StatsErases = 0;                                            // pages erased, before programming or left blank
+UWord16 StatsEraseMax = 0;                                          // Timer1 ticks of the slowest erase
+UWord32 StatsEraseTotal = 0;                                        // Timer1 ticks of all erases
+
+const UWord32 CrcTable[16] = {                                      // reflected CRC-32, one nibble at a time
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
 
 //---------------------------------------------------------------------------------------------------
 // Function declarations
@@ -72,13 +129,30 @@ char Buffer[PM_ROW_SIZE*3 + 1];
 int main(void);
 void initMain(void);
 void initRapidFlashLED(void);
+void initRxDMA(void);
 
 extern UWord32 ReadLatch(UWord16, UWord16);
+extern void WriteRow(UWord16, UWord16, char *);
 void PutChar(char);
 void GetChar(char *);
+void PutByte(char);
+void GetByte(char *);
+char TakeByte(char *);
+char ReceiveFrame(void);
+void SendFrame(void);
+UWord32 PutCrc(UWord32, char);
 void WriteBuffer(char *, int);
-void ReadPM(char *, uReg32);
+void PutPM(uReg32, UWord16);
 void WritePM(char *, uReg32);
+UWord32 Crc32(UWord32, char);
+void ReceiveRLE(char *);
+void PutCaps(void);
+void SetBaud(UWord32);
+char GetCharTimeout(void);
+UWord32 ReadCRC(uReg32);
+UWord32 CrcPM(UWord32, uReg32, UWord32);
+char ComparePM(char *, uReg32);
+char BlankPM(uReg32);
 
 //====================================================================================================
 // Functions
@@ -110,12 +184,22 @@ int main(void) {
 		T4CONbits.TON=1;                                            // Enable Timer
 	}
 	U1BRG = BRGVAL;                                                 // BAUD Rate Setting of UART
+	initRxDMA();                                                    // before the UART, so no byte is missed
 	U1MODE = 0x8000;                                                // Reset UART to 8-n-1, alt pins, and enable
 	U1STA  = 0x0400;                                                // Reset status register and enable TX
+	T1CON = 0x8020;                                                 // Timer1 times page writes, 64 / FCY a tick
 
 	while(1) {
 		char Command;
-		GetChar(&Command);
+		do {
+			GetByte(&Command);
+		} while(Framed && (Command != COMMAND_FRAME));              // skip anything between frames
+		if(Command == COMMAND_FRAME) {
+			if(ReceiveFrame() == 0) {
+				continue;
+			}
+			GetChar(&Command);
+		}
 		switch(Command) {
 			case COMMAND_READ_PM:				                    // tested
 			{
@@ -124,26 +208,166 @@ int main(void) {
 				GetChar(&(SourceAddr.Val[1]));
 				GetChar(&(SourceAddr.Val[2]));
 				SourceAddr.Val[3]=0;
-				ReadPM(Buffer, SourceAddr);
-				WriteBuffer(Buffer, PM_ROW_SIZE*3);
+				PutPM(SourceAddr, PM_ROW_SIZE);                     // flash is read while the TX FIFO drains
 				break;
 			}
 			case COMMAND_WRITE_PM:				                    // tested
+			case COMMAND_WRITE_PM_RLE:
 			{
 			    uReg32 SourceAddr;
 				int Size;
+				char * ptrRow;
+				UWord16 Ticks;
+				char Path;
 				GetChar(&(SourceAddr.Val[0]));
 				GetChar(&(SourceAddr.Val[1]));
 				GetChar(&(SourceAddr.Val[2]));
 				SourceAddr.Val[3]=0;
-				for(Size = 0; Size < PM_ROW_SIZE*3; Size++) {
-				    GetChar(&(Buffer[Size]));
+				ptrRow = RxBuffer;
+				if(Command == COMMAND_WRITE_PM) {
+					for(Size = 0; Size < PM_ROW_SIZE*3; Size++) {
+					    GetChar(&(ptrRow[Size]));
+					}
+				}
+				else {
+					ReceiveRLE(ptrRow);
+				}
+				if(FrameUnderrun) {                                 // short frame, the page isn't all there
+					break;
+				}
+				Path = ComparePM(ptrRow, SourceAddr);               // spare the page an erase, or both, if possible
+				if(Path != ACK_UNCHANGED) {
+					ftdiCtsPin = 1;                                 // hold off host, CPU stalls during erase and write
+					if(Path == COMMAND_ACK) {
+						TMR1 = 0;
+						Erase(SourceAddr.Word.HW,SourceAddr.Word.LW,PM_ROW_ERASE);
+						Ticks = TMR1;
+						StatsErases++;
+						StatsEraseTotal += Ticks;
+						if(Ticks > StatsEraseMax) {
+							StatsEraseMax = Ticks;
+						}
+					}
+					TMR1 = 0;
+					WritePM(ptrRow, SourceAddr);	                // program page
+					Ticks = TMR1;
+					ftdiCtsPin = 0;
+					StatsPages++;
+					StatsTotal += Ticks;
+					if(Ticks > StatsMax) {
+						StatsMax = Ticks;
+					}
 				}
+				PutChar(AckPath ? Path : COMMAND_ACK);              // Send Acknowledgement
+ 				break;
+			}
+			case COMMAND_ERASE_PM:                                  // blank page, erase without programming
+			{
+			    uReg32 SourceAddr;
+				UWord16 Ticks;
+				GetChar(&(SourceAddr.Val[0]));
+				GetChar(&(SourceAddr.Val[1]));
+				GetChar(&(SourceAddr.Val[2]));
+				SourceAddr.Val[3]=0;
+				if(FrameUnderrun) {
+					break;
+				}
+				if(BlankPM(SourceAddr)) {                           // already erased
+					PutChar(AckPath ? ACK_UNCHANGED : COMMAND_ACK);
+					break;
+				}
+				ftdiCtsPin = 1;
+				TMR1 = 0;
 				Erase(SourceAddr.Word.HW,SourceAddr.Word.LW,PM_ROW_ERASE);
-				WritePM(Buffer, SourceAddr);	                    // program page
+				Ticks = TMR1;
+				ftdiCtsPin = 0;
+				StatsErases++;
+				StatsEraseTotal += Ticks;
+				if(Ticks > StatsEraseMax) {
+					StatsEraseMax = Ticks;
+				}
 				PutChar(COMMAND_ACK);			                    // Send Acknowledgement
  				break;
 			}
+			case COMMAND_READ_CAPS:                                 // older bootloaders reply NACK
+			{
+				PutCaps();
+				break;
+			}
+			case COMMAND_SET_BAUD:
+			{
+				uReg32 Baud;
+				GetChar(&(Baud.Val[0]));
+				GetChar(&(Baud.Val[1]));
+				GetChar(&(Baud.Val[2]));
+				GetChar(&(Baud.Val[3]));
+				if((Baud.Val32 < 9600) || Framed) {                 // the switch can't be confirmed inside a frame
+					PutChar(COMMAND_NACK);
+					break;
+				}
+				PutChar(COMMAND_ACK);			                    // acknowledge at the old rate
+				SetBaud(Baud.Val32);
+				break;
+			}
+			case COMMAND_READ_CRC:                                  // CRC-32 of each of a number of pages
+			{
+				uReg32 SourceAddr;
+				uReg32 Crc;
+				char Count;
+				unsigned int Rows;
+				GetChar(&(SourceAddr.Val[0]));
+				GetChar(&(SourceAddr.Val[1]));
+				GetChar(&(SourceAddr.Val[2]));
+				SourceAddr.Val[3]=0;
+				GetChar(&Count);
+				for(Rows = (unsigned char)Count; Rows != 0; Rows--) {
+					Crc.Val32 = ReadCRC(SourceAddr);
+					WriteBuffer(&(Crc.Val[0]), 4);
+					SourceAddr.Val32 = SourceAddr.Val32 + PM_ROW_SIZE*2;
+				}
+				break;
+			}
+			case COMMAND_CRC_RANGE:                                 // one CRC-32 over any number of instructions
+			{
+				uReg32 SourceAddr;
+				uReg32 Count;
+				uReg32 Crc;
+				GetChar(&(SourceAddr.Val[0]));
+				GetChar(&(SourceAddr.Val[1]));
+				GetChar(&(SourceAddr.Val[2]));
+				SourceAddr.Val[3]=0;
+				GetChar(&(Count.Val[0]));
+				GetChar(&(Count.Val[1]));
+				GetChar(&(Count.Val[2]));
+				Count.Val[3]=0;
+				Crc.Val32 = ~CrcPM(0xFFFFFFFF, SourceAddr, Count.Val32);
+				WriteBuffer(&(Crc.Val[0]), 4);
+				break;
+			}
+			case COMMAND_READ_STATS:                                // pages written, slowest and total write in us, then the same for erases
+			{
+				uReg32 Us;
+				PutChar((char)StatsPages);
+				PutChar((char)(StatsPages >> 8));
+				Us.Val32 = ((UWord32)StatsMax * 8) / 5;             // 1.6 us a tick
+				WriteBuffer(&(Us.Val[0]), 4);
+				Us.Val32 = (StatsTotal * 8) / 5;
+				WriteBuffer(&(Us.Val[0]), 4);
+				PutChar((char)StatsErases);
+				PutChar((char)(StatsErases >> 8));
+				Us.Val32 = ((UWord32)StatsEraseMax * 8) / 5;
+				WriteBuffer(&(Us.Val[0]), 4);
+				Us.Val32 = (StatsEraseTotal * 8) / 5;
+				WriteBuffer(&(Us.Val[0]), 4);
+				break;
+			}
+			case COMMAND_HELLO:                                     // options, then capabilities then device ID
+				if(FrameSize > 1) {                                 // older hosts send no options
+					char Options;
+					GetChar(&Options);
+					AckPath = Options & HELLO_ACK_PATH;
+				}
+				PutCaps();
 			case COMMAND_READ_ID:
 			{
 				uReg32 SourceAddr;
@@ -159,6 +383,10 @@ int main(void) {
 			case COMMAND_WRITE_CM:	
 			{
 				int Size;
+				if(Framed && (FrameSize < 1 + CM_ROW_SIZE*3)) {     // keep the words of the last whole frame
+					PutChar(COMMAND_NACK);
+					break;
+				}
 				for(Size = 0; Size < CM_ROW_SIZE*3;) {
 					GetChar(&(Buffer[Size++]));
 					GetChar(&(Buffer[Size++]));
@@ -181,11 +409,13 @@ int main(void) {
 						WriteMem(CONFIG_WORD_WRITE);
 					}
 				}
+				DMA0CON = 0x0000;                                   // hand the UART to the application without DMA
 				ResetDevice();
 				break;
 			}
 			case COMMAND_NACK:
 			{
+				DMA0CON = 0x0000;
 				ResetDevice();
 				break;
 			}
@@ -193,6 +423,20 @@ int main(void) {
 				PutChar(COMMAND_NACK);
 				break;
 		}
+		if(FrameUnderrun) {                                         // nothing was done, the host resends
+			ReplySize = 0;
+			PutChar(COMMAND_NACK);
+		}
+		if(Framed) {
+			SendFrame();
+		}
+		if(RxOverrun) {                                             // a frame is resent, a bare command can't be
+			RxOverrun = 0;
+			if(!Framed) {
+				DMA0CON = 0x0000;
+				ResetDevice();
+			}
+		}
 	}
 }
 
@@ -220,7 +464,7 @@ void initMain(void) {
 	_RP17R = 0b00011;							// RP17 (RC1) mapped to U1TX (FTDI RX)
 	_U1RXR = 19;								// RP19 (RC3) mapped to U1RX (FTDI TX)
 	_U1CTSR = 18;								// RP18 (RC2) mapped to U2CTS (FTDI RTS)
-	_RP16R = 0b00100;							// RP16 (RC0) mapped to U2RTS (FTDI CTS)
+	_RP16R = 0;									// RP16 (RC0) left as port pin, driven as FTDI CTS for flow control
 	_RP5R = 0b00101;							// RP5 (RB5) mapped to U2TX (Bluetooth RX)
 	_U2RXR = 21;								// RP21 (RC5) mapped to U2RX (Bluetooth TX)
 	_U2CTSR = 20;								// RP20 (RC4) mapped to U2CTS (Bluetooth RTS)
@@ -270,41 +514,148 @@ void initRapidFlashLED(void) {
     OC1RS = 0x8000;                     // 50% duty cycle
 }    
 
+//---------------------------------------------------------------------------------------------------
+// UART1 receive through DMA
+// DMA0 copies every received byte into RxRing, so bytes keep arriving while the CPU is stalled by
+// flash operations. The ring has no write pointer to read back: a slot holds a byte once it is no
+// longer RX_EMPTY, and is emptied again as it is read. The slot behind RxHead was emptied by the
+// last read, so finding it full means DMA0 has gone all the way round and is overwriting unread
+// bytes. The ring is then restarted and the read returns a NACK: inside a frame the CRC fails and
+// the host resends, outside one the session is dropped as the host can't be told what was lost.
+// Unframed hosts must therefore stay within the ring, which CTS does while flash is written.
+
+void initRxDMA(void) {
+	UWord16 Index;
+	for(Index = 0; Index < RX_RING_SIZE; Index++) {
+		RxRing[Index] = RX_EMPTY;
+	}
+	RxHead = 0;
+	DMA0CON = 0x0000;                   // words, peripheral to RAM, post-increment, continuous, no ping-pong
+	DMA0REQ = DMA_REQ_U1RX;
+	DMA0PAD = (volatile unsigned int) &U1RXREG;
+	DMA0STA = __builtin_dmaoffset(RxRing);
+	DMA0CNT = RX_RING_SIZE - 1;         // wraps back to the start of the ring
+	IFS0bits.DMA0IF = 0;
+	DMA0CONbits.CHEN = 1;
+}
+
 //---------------------------------------------------------------------------------------------------
 // Subroutines
 
 void GetChar(char * ptrChar) {
+	if(Framed) {                        // arguments come from the received frame
+		if(FrameIndex >= FrameSize) {   // never past the payload, the command is NACKed instead
+			FrameUnderrun = 1;
+			* ptrChar = 0;
+			return;
+		}
+		* ptrChar = Frame[FrameIndex++];
+		return;
+	}
+	GetByte(ptrChar);
+}
+
+void GetByte(char * ptrChar) {
 	while(1) {
 		if(IFS1bits.T5IF == 1) {        // if timer expired, signal to application to jump to user code
 			* ptrChar = COMMAND_NACK;
 			break;
 		}
-		if(U1STAbits.FERR == 1)	{       // check for receive errors
-			continue;
-		}
 		if(U1STAbits.OERR == 1)	{       // must clear the overrun error to keep uart receiving
 			U1STAbits.OERR = 0;
 			continue;
 		}
-		if(U1STAbits.URXDA == 1) {      // get the data
+		if(TakeByte(ptrChar)) {         // get the data, frame CRCs catch framing errors
 			T4CONbits.TON=0;            // Disable timer countdown
-			* ptrChar = U1RXREG;
 			break;
 		}
 	}
 }
 
-void ReadPM(char * ptrData, uReg32 SourceAddr) {
-	int Size;
-	uReg32 Temp;
-	for(Size = 0; Size < PM_ROW_SIZE; Size++) {
-		Temp.Val32 = ReadLatch(SourceAddr.Word.HW, SourceAddr.Word.LW);
-		ptrData[0] = Temp.Val[2];;
-		ptrData[1] = Temp.Val[1];;
-		ptrData[2] = Temp.Val[0];;
-		ptrData = ptrData + 3;
-		SourceAddr.Val32 = SourceAddr.Val32 + 2;
+char TakeByte(char * ptrChar) {         // 1 if a byte was waiting in the ring
+	if(RxRing[(RxHead - 1) & (RX_RING_SIZE - 1)] != RX_EMPTY) {
+		initRxDMA();                    // overrun, start again from an empty ring
+		RxOverrun = 1;
+		* ptrChar = COMMAND_NACK;
+		return 1;
+	}
+	if(RxRing[RxHead] == RX_EMPTY) {
+		return 0;
+	}
+	* ptrChar = (char)RxRing[RxHead];
+	RxRing[RxHead] = RX_EMPTY;
+	RxHead = (RxHead + 1) & (RX_RING_SIZE - 1);
+	return 1;
+}
+
+void PutPM(uReg32 SourceAddr, UWord16 Count) {                     // Count instructions, most significant byte first
+	UWord16 Offset = SourceAddr.Word.LW;
+	UWord16 Low;
+	TBLPAG = SourceAddr.Word.HW;                                    // a row never crosses a table page
+	for(; Count != 0; Count--, Offset += 2) {
+		Low = __builtin_tblrdl(Offset);
+		PutChar((char)__builtin_tblrdh(Offset));
+		PutChar((char)(Low >> 8));
+		PutChar((char)Low);
+	}
+}
+
+UWord32 Crc32(UWord32 Crc, char Byte) {
+	Crc = (Crc >> 4) ^ CrcTable[(Crc ^ Byte) & 0x0F];
+	Crc = (Crc >> 4) ^ CrcTable[(Crc ^ (Byte >> 4)) & 0x0F];
+	return Crc;
+}
+
+UWord32 ReadCRC(uReg32 SourceAddr) {                               // page CRC over bytes in the order WritePM takes them
+	return ~CrcPM(0xFFFFFFFF, SourceAddr, PM_ROW_SIZE);
+}
+
+UWord32 CrcPM(UWord32 Crc, uReg32 SourceAddr, UWord32 Count) {     // continues Crc over Count instructions
+	UWord16 Offset = SourceAddr.Word.LW;
+	UWord16 Low;
+	TBLPAG = SourceAddr.Word.HW;
+	for(; Count != 0; Count--) {
+		Low = __builtin_tblrdl(Offset);
+		Crc = Crc32(Crc, (char)Low);
+		Crc = Crc32(Crc, (char)(Low >> 8));
+		Crc = Crc32(Crc, (char)__builtin_tblrdh(Offset));
+		Offset += 2;
+		if(Offset == 0) {                                           // next table page
+			TBLPAG++;
+		}
 	}
+	return Crc;
+}
+
+char ComparePM(char * ptrData, uReg32 SourceAddr) {                // the write a page needs: ACK_UNCHANGED if it holds
+	UWord16 Offset = SourceAddr.Word.LW;                            // ptrData already, ACK_NO_ERASE if it is blank,
+	UWord16 Count;                                                  // COMMAND_ACK for an erase and write
+	TBLPAG = SourceAddr.Word.HW;
+	for(Count = 0; Count < PM_ROW_SIZE; Count++, Offset += 2, ptrData += 3) {
+		if((__builtin_tblrdl(Offset) != ((UWord16)(unsigned char)ptrData[0] | ((UWord16)(unsigned char)ptrData[1] << 8))) ||
+		   ((__builtin_tblrdh(Offset) & 0xFF) != (unsigned char)ptrData[2])) {
+			break;
+		}
+	}
+	if(Count == PM_ROW_SIZE) {
+		return ACK_UNCHANGED;
+	}
+	if(BlankPM(SourceAddr)) {
+		return ACK_NO_ERASE;
+	}
+	return COMMAND_ACK;
+}
+
+char BlankPM(uReg32 SourceAddr) {                                   // 1 if every instruction of the page is erased
+	UWord16 Offset = SourceAddr.Word.LW;
+	UWord16 Count;
+	TBLPAG = SourceAddr.Word.HW;
+	for(Count = 0; Count < PM_ROW_SIZE; Count++, Offset += 2) {
+		if((__builtin_tblrdl(Offset) != 0xFFFF) || ((__builtin_tblrdh(Offset) & 0xFF) != 0xFF)) {
+			return 0;
+		}
+	}
+	return 1;
 }
 
 void WriteBuffer(char * ptrData, int Size) {
@@ -314,36 +665,155 @@ void WriteBuffer(char * ptrData, int Size) {
 	}
 }
 
-void PutChar(char Char) {
+void ReceiveRLE(char * ptrRow) {                                    // each control byte is followed by its words
+	int Size;
+	int Count;
+	char Control;
+	char Repeat;
+	for(Size = 0; Size < PM_ROW_SIZE*3;) {
+		GetChar(&Control);
+		if(Control & 0x80) {
+			Count = (Control & 0x3F) + 1;                           // 10nnnnnn: n+1 words of 3 bytes
+		}                                                           // 11nnnnnn: 1 word of 3 bytes, n+1 times
+		else {
+			Count = Control + 1;                                    // 0nnnnnnn: n+1 words of 2 bytes, upper byte 0
+		}
+		Repeat = 0;
+		for(; (Count != 0) && (Size < PM_ROW_SIZE*3); Count--) {
+			if(Repeat) {
+				ptrRow[Size] = ptrRow[Size-3];
+				ptrRow[Size+1] = ptrRow[Size-2];
+				ptrRow[Size+2] = ptrRow[Size-1];
+			}
+			else {
+				GetChar(&(ptrRow[Size]));
+				GetChar(&(ptrRow[Size+1]));
+				ptrRow[Size+2] = 0;
+				if(Control & 0x80) {
+					GetChar(&(ptrRow[Size+2]));
+				}
+				Repeat = ((Control & 0xC0) == 0xC0);
+			}
+			Size += 3;
+		}
+	}
+}
+
+void PutCaps(void) {
+	PutChar(COMMAND_ACK);
+	PutChar(BOOTLOADER_VERSION);
+	PutChar(CAPS);
+}
+
+void SetBaud(UWord32 Baud) {                                        // switch to high speed mode, revert unless host confirms
+	while(!U1STAbits.TRMT);                                         // let the acknowledgement finish at the old rate
+	U1MODEbits.BRGH = 1;
+	U1BRG = (UWord16)((FCY + 2 * Baud) / (4 * Baud) - 1);          // nearest divider, FCY / (4 * (BRG + 1))
+	if(GetCharTimeout() == COMMAND_READ_CAPS) {                     // host is sending at the new rate
+		PutCaps();
+		if(GetCharTimeout() == COMMAND_ACK) {                       // and receiving it
+			return;
+		}
+	}
 	while(!U1STAbits.TRMT);
-	U1TXREG = Char;
+	U1MODEbits.BRGH = 0;
+	U1BRG = BRGVAL;
 }
 
-void WritePM(char * ptrData, uReg32 SourceAddr) {
-	int Size,Size1;
-	uReg32 Temp;
-	uReg32 TempAddr;
-	uReg32 TempData;
-	for(Size = 0,Size1=0; Size < PM_ROW_SIZE; Size++) {
-		Temp.Val[0]=ptrData[Size1+0];
-		Temp.Val[1]=ptrData[Size1+1];
-		Temp.Val[2]=ptrData[Size1+2];
-		Temp.Val[3]=0;
-		Size1+=3;
-	   	WriteLatch(SourceAddr.Word.HW, SourceAddr.Word.LW,Temp.Word.HW,Temp.Word.LW);
-
-		/* Device ID errata workaround: Save data at any address that has LSB 0x18 */
-		if((SourceAddr.Val32 & 0x0000001F) == 0x18) {
-			TempAddr.Val32 = SourceAddr.Val32;
-			TempData.Val32 = Temp.Val32;
+char GetCharTimeout(void) {                                         // NACK if nothing arrives within about 420 ms
+	TMR3 = 0;
+	PR3 = 0xFFFF;
+	IFS0bits.T3IF = 0;
+	T3CON = 0x8030;                                                 // 1:256 prescaler
+	while(!IFS0bits.T3IF) {
+		char Char;
+		if(U1STAbits.OERR == 1) {
+			U1STAbits.OERR = 0;
 		}
-		if((Size !=0) && (((Size + 1) % 64) == 0)) {
-    		
-            /* Device ID errata workaround: Reload data at address with LSB of 0x18 */
-	        WriteLatch(TempAddr.Word.HW, TempAddr.Word.LW,TempData.Word.HW,TempData.Word.LW);
-			WriteMem(PM_ROW_WRITE);
+		if(TakeByte(&Char)) {
+			T3CON = 0;
+			return Char;
 		}
-		SourceAddr.Val32 = SourceAddr.Val32 + 2;
+	}
+	T3CON = 0;
+	return COMMAND_NACK;
+}
+
+void PutChar(char Char) {
+	if(Framed) {                                                    // replies are collected and sent as one frame
+		Frame[ReplySize++] = Char;
+		return;
+	}
+	PutByte(Char);
+}
+
+void PutByte(char Char) {                                           // queues behind up to 4 bytes in the TX FIFO
+	while(U1STAbits.UTXBF);
+	U1TXREG = Char;
+}
+
+char ReceiveFrame(void) {                                           // sequence, 16-bit length, payload, CRC-32
+	uReg32 Size;
+	uReg32 Crc;
+	UWord32 Check;
+	UWord16 Index;
+	Framed = 1;
+	FrameIndex = 0;
+	FrameUnderrun = 0;
+	ReplySize = 0;
+	Size.Val32 = 0;
+	GetByte(&FrameSeq);
+	GetByte(&(Size.Val[0]));
+	GetByte(&(Size.Val[1]));
+	if(Size.Val32 > FRAME_SIZE) {                                   // not a real header, hunt for the next one
+		return 0;
+	}
+	FrameSize = Size.Word.LW;
+	Check = Crc32(Crc32(Crc32(0xFFFFFFFF, FrameSeq), Size.Val[0]), Size.Val[1]);
+	for(Index = 0; Index < Size.Word.LW; Index++) {
+		GetByte(&(Frame[Index]));
+		Check = Crc32(Check, Frame[Index]);
+	}
+	GetByte(&(Crc.Val[0]));
+	GetByte(&(Crc.Val[1]));
+	GetByte(&(Crc.Val[2]));
+	GetByte(&(Crc.Val[3]));
+	if((Crc.Val32 != ~Check) || (FrameSize == 0)) {                 // an empty frame has no command
+		PutChar(COMMAND_NACK);                                      // host resends just this sequence number
+		SendFrame();
+		return 0;
+	}
+	return 1;
+}
+
+void SendFrame(void) {                                              // reply with what PutChar collected
+	UWord16 Index;
+	uReg32 Crc;
+	PutByte(COMMAND_FRAME);
+	Crc.Val32 = PutCrc(0xFFFFFFFF, FrameSeq);
+	Crc.Val32 = PutCrc(Crc.Val32, ReplySize & 0xFF);
+	Crc.Val32 = PutCrc(Crc.Val32, ReplySize >> 8);
+	for(Index = 0; Index < ReplySize; Index++) {
+		Crc.Val32 = PutCrc(Crc.Val32, Frame[Index]);
+	}
+	Crc.Val32 = ~Crc.Val32;
+	PutByte(Crc.Val[0]);
+	PutByte(Crc.Val[1]);
+	PutByte(Crc.Val[2]);
+	PutByte(Crc.Val[3]);
+}
+
+UWord32 PutCrc(UWord32 Crc, char Byte) {
+	PutByte(Byte);
+	return Crc32(Crc, Byte);
+}
+
+void WritePM(char * ptrData, uReg32 SourceAddr) {                  // a page, row by row, with the Device ID errata
+	UWord16 Row;                                                    // workaround in WriteRow
+	for(Row = 0; Row < PM_ROW_SIZE / WRITE_ROW_SIZE; Row++) {
+		WriteRow(SourceAddr.Word.HW, SourceAddr.Word.LW, ptrData);
+		ptrData = ptrData + WRITE_ROW_SIZE*3;
+		SourceAddr.Val32 = SourceAddr.Val32 + WRITE_ROW_SIZE*2;
 	}
 }
 
@@ -30,7 +30,7 @@
 
 .include "p33fxxxx.inc"
 
-.global _LoadAddr,_WriteMem,_WriteLatch,_ReadLatch,_ResetDevice,_Erase ;C called
+.global _LoadAddr,_WriteMem,_WriteLatch,_WriteRow,_ReadLatch,_ResetDevice,_Erase ;C called
 
 
 _LoadAddr:	;W0=NVMADRU,W1=NVMADR - no return values
@@ -62,6 +62,44 @@ _WriteLatch: ;W0=TBLPAG,W1=Wn,W2=WordHi,W3=WordLo - no return values
 	
 	return
 	
+;***************************************************************
+_WriteRow: ;W0=TBLPAG,W1=row offset,W2=64 instructions of 3 bytes, low first - no return values
+
+	push	TBLPAG
+	mov	W0,TBLPAG
+	mov	W1,W6			; kept for the errata reload
+	mov	W2,W7
+	mov	#64,W5
+
+row_load:
+	ze	[W2++],W3		; low word from the low and middle bytes
+	ze	[W2++],W4
+	sl	W4,#8,W4
+	ior	W3,W4,W3
+	ze	[W2++],W4		; upper byte
+	tblwtl	W3,[W1]
+	tblwth	W4,[W1++]
+	dec	W5,W5
+	bra	nz,row_load
+
+	mov	#0x78,W0		; Device ID errata workaround: reload the latch
+	add	W6,W0,W6		; at the last address in the row with LSB 0x18
+	mov	#180,W0
+	add	W7,W0,W7
+	ze	[W7++],W3
+	ze	[W7++],W4
+	sl	W4,#8,W4
+	ior	W3,W4,W3
+	ze	[W7++],W4
+	tblwtl	W3,[W6]
+	tblwth	W4,[W6]
+
+	mov	#0x4001,W0		; PM_ROW_WRITE
+	rcall	_WriteMem
+
+	pop	TBLPAG
+	return
+
 ;***************************************************************	
 _ReadLatch: ;W0=TBLPAG,W1=Wn - data in W1:W0
 	mov	W0,TBLPAG	